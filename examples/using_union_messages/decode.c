@@ -25,7 +25,7 @@ const pb_field_t* decode_unionmessage_type(pb_istream_t *stream)
         if (wire_type == PB_WT_STRING)
         {
             const pb_field_t *field;
-            for (field = UnionMessage_fields; field->tag != 0; field++)
+            for (field = PB_FIRST_FIELD(UnionMessage_fields); field->tag != 0; field++)
             {
                 if (field->tag == tag && (field->type & PB_LTYPE_SUBMESSAGE))
                 {
@@ -66,19 +66,19 @@ int main()
     
     if (type == MsgType1_fields)
     {
-        MsgType1 msg = {};
+        MsgType1 msg = MsgType1_init_zero;
         status = decode_unionmessage_contents(&stream, MsgType1_fields, &msg);
         printf("Got MsgType1: %d\n", msg.value);
     }
     else if (type == MsgType2_fields)
     {
-        MsgType2 msg = {};
+        MsgType2 msg = MsgType2_init_zero;
         status = decode_unionmessage_contents(&stream, MsgType2_fields, &msg);
         printf("Got MsgType2: %s\n", msg.value ? "true" : "false");
     }
     else if (type == MsgType3_fields)
     {
-        MsgType3 msg = {};
+        MsgType3 msg = MsgType3_init_zero;
         status = decode_unionmessage_contents(&stream, MsgType3_fields, &msg);
         printf("Got MsgType3: %d %d\n", msg.value1, msg.value2);    
     }
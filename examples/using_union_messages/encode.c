@@ -17,7 +17,7 @@
 bool encode_unionmessage(pb_ostream_t *stream, const pb_field_t messagetype[], const void *message)
 {
     const pb_field_t *field;
-    for (field = UnionMessage_fields; field->tag != 0; field++)
+    for (field = PB_FIRST_FIELD(UnionMessage_fields); field->tag != 0; field++)
     {
         if (field->ptr == messagetype)
         {
@@ -35,17 +35,18 @@ bool encode_unionmessage(pb_ostream_t *stream, const pb_field_t messagetype[], c
 
 int main(int argc, char **argv)
 {
+    uint8_t buffer[512];
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    bool status = false;
+    int msgtype;
+    
     if (argc != 2)
     {
         fprintf(stderr, "Usage: %s (1|2|3)\n", argv[0]);
         return 1;
     }
     
-    uint8_t buffer[512];
-    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
-    
-    bool status = false;
-    int msgtype = atoi(argv[1]);
+    msgtype = atoi(argv[1]);
     if (msgtype == 1)
     {
         /* Send message of type 1 */
@@ -0,0 +1,127 @@
+/* pb_io.c: Buffered nanopb streams for file descriptors and FILE handles.
+ * See pb_io.h for the interface.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "pb_io.h"
+
+#ifndef PB_BUFFER_ONLY
+size_t pb_fill_from_fd(void *source, uint8_t *buf, size_t count)
+{
+    int fd = (int)(intptr_t)source;
+    ssize_t result;
+    
+    do {
+        result = read(fd, buf, count);
+    } while (result < 0 && errno == EINTR);
+    
+    if (result < 0)
+        return SIZE_MAX;
+    
+    return (size_t)result;
+}
+
+size_t pb_fill_from_file(void *source, uint8_t *buf, size_t count)
+{
+    FILE *file = (FILE*)source;
+    size_t result = fread(buf, 1, count, file);
+    
+    if (result == 0 && ferror(file))
+        return SIZE_MAX;
+    
+    return result;
+}
+
+/* The seek functions move to the last skipped byte and read it, so that
+ * a source that ends too early is detected like when reading. */
+bool pb_seek_fd(void *source, size_t count)
+{
+    int fd = (int)(intptr_t)source;
+    uint8_t last;
+    
+    if (count == 0)
+        return true;
+    
+    if (count - 1 > (size_t)LONG_MAX ||
+        lseek(fd, (off_t)(count - 1), SEEK_CUR) == (off_t)-1)
+        return false;
+    
+    return pb_fill_from_fd(source, &last, 1) == 1;
+}
+
+bool pb_seek_file(void *source, size_t count)
+{
+    FILE *file = (FILE*)source;
+    
+    if (count == 0)
+        return true;
+    
+    if (count - 1 > (size_t)LONG_MAX ||
+        fseek(file, (long)(count - 1), SEEK_CUR) != 0)
+        return false;
+    
+    return fgetc(file) != EOF;
+}
+
+pb_istream_t pb_istream_from_fd(pb_readahead_t *readahead, int fd,
+                                uint8_t *buf, size_t bufsize)
+{
+    pb_readahead_init(readahead, buf, bufsize, &pb_fill_from_fd, (void*)(intptr_t)fd);
+    readahead->seek = &pb_seek_fd;
+    return pb_istream_from_readahead(readahead, SIZE_MAX);
+}
+
+pb_istream_t pb_istream_from_file(pb_readahead_t *readahead, FILE *file,
+                                  uint8_t *buf, size_t bufsize)
+{
+    pb_readahead_init(readahead, buf, bufsize, &pb_fill_from_file, file);
+    readahead->seek = &pb_seek_file;
+    return pb_istream_from_readahead(readahead, SIZE_MAX);
+}
+#endif
+
+#ifndef PB_BUFFER_ONLY
+bool pb_drain_to_fd(void *sink, const uint8_t *buf, size_t count)
+{
+    int fd = (int)(intptr_t)sink;
+    
+    while (count > 0)
+    {
+        ssize_t result = write(fd, buf, count);
+        
+        if (result < 0 && errno == EINTR)
+            continue;
+        
+        if (result <= 0)
+            return false;
+        
+        buf += result;
+        count -= (size_t)result;
+    }
+    
+    return true;
+}
+
+bool pb_drain_to_file(void *sink, const uint8_t *buf, size_t count)
+{
+    FILE *file = (FILE*)sink;
+    return fwrite(buf, 1, count, file) == count;
+}
+
+pb_ostream_t pb_ostream_from_fd(pb_writebuf_t *writebuf, int fd,
+                                uint8_t *buf, size_t bufsize)
+{
+    pb_writebuf_init(writebuf, buf, bufsize, &pb_drain_to_fd, (void*)(intptr_t)fd);
+    return pb_ostream_from_writebuf(writebuf, SIZE_MAX);
+}
+
+pb_ostream_t pb_ostream_from_file(pb_writebuf_t *writebuf, FILE *file,
+                                  uint8_t *buf, size_t bufsize)
+{
+    pb_writebuf_init(writebuf, buf, bufsize, &pb_drain_to_file, file);
+    return pb_ostream_from_writebuf(writebuf, SIZE_MAX);
+}
+#endif
@@ -0,0 +1,66 @@
+/* pb_io.h: Buffered nanopb streams for POSIX file descriptors and C
+ * standard library FILE handles. These are not part of the core library,
+ * add pb_io.c to your build if you want to use them.
+ *
+ * The buffer and the pb_readahead_t or pb_writebuf_t state are supplied by
+ * the caller. They must remain valid for as long as the stream is used.
+ * The streams need callback support, so they are not available when
+ * PB_BUFFER_ONLY is defined.
+ */
+
+#ifndef PB_IO_H_INCLUDED
+#define PB_IO_H_INCLUDED
+
+#include <stdio.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef PB_BUFFER_ONLY
+/* Fill functions for pb_readahead_init(). The source is a file descriptor
+ * casted to (void*)(intptr_t)fd, or a FILE pointer. */
+size_t pb_fill_from_fd(void *source, uint8_t *buf, size_t count);
+size_t pb_fill_from_file(void *source, uint8_t *buf, size_t count);
+
+/* Seek functions for the seek member of pb_readahead_t. They fail on
+ * sources that are not seekable, such as pipes and sockets. */
+bool pb_seek_fd(void *source, size_t count);
+bool pb_seek_file(void *source, size_t count);
+
+/* Create a buffered input stream for reading from a file descriptor, such as
+ * a socket. Reads only the data that is already available, so it is safe to
+ * use for request/response protocols. */
+pb_istream_t pb_istream_from_fd(pb_readahead_t *readahead, int fd,
+                                uint8_t *buf, size_t bufsize);
+
+/* Create a buffered input stream for reading from a FILE. Unknown fields
+ * are skipped by seeking, if the file is seekable. */
+pb_istream_t pb_istream_from_file(pb_readahead_t *readahead, FILE *file,
+                                  uint8_t *buf, size_t bufsize);
+#endif
+
+#ifndef PB_BUFFER_ONLY
+/* Drain functions for pb_writebuf_init(). The sink is a file descriptor
+ * casted to (void*)(intptr_t)fd, or a FILE pointer. */
+bool pb_drain_to_fd(void *sink, const uint8_t *buf, size_t count);
+bool pb_drain_to_file(void *sink, const uint8_t *buf, size_t count);
+
+/* Create a buffered output stream for writing to a file descriptor, such as
+ * a socket. Remember to call pb_ostream_flush() after encoding. */
+pb_ostream_t pb_ostream_from_fd(pb_writebuf_t *writebuf, int fd,
+                                uint8_t *buf, size_t bufsize);
+
+/* Create a buffered output stream for writing to a FILE. The data is passed
+ * to fwrite() by pb_ostream_flush(), it is not flushed from the FILE. */
+pb_ostream_t pb_ostream_from_file(pb_writebuf_t *writebuf, FILE *file,
+                                  uint8_t *buf, size_t bufsize);
+#endif
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
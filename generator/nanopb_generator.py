@@ -109,6 +109,22 @@ assert varint_max_size(0) == 1
 assert varint_max_size(127) == 1
 assert varint_max_size(128) == 2
 
+def encoded_tag(tag, wire_type):
+    '''Returns the encoded bytes of a field tag as a C string literal,
+    and the number of bytes.'''
+    value = (tag << 3) | wire_type
+    result = ''
+    count = 0
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            byte |= 0x80
+        result += '\\x%02x' % byte
+        count += 1
+        if not value:
+            return '"' + result + '"', count
+
 class EncodedSize:
     '''Class used to represent the encoded size of a field or a message.
     Consists of a combination of symbolic sizes and integer sizes.'''
@@ -184,6 +200,8 @@ class Field:
         self.default = None
         self.max_size = None
         self.max_count = None
+        self.expected_count = None
+        self.lazy = False
         self.array_decl = ""
         self.enc_size = None
         self.ctype = None
@@ -195,6 +213,9 @@ class Field:
         if field_options.HasField("max_count"):
             self.max_count = field_options.max_count
         
+        if field_options.HasField("expected_count"):
+            self.expected_count = field_options.expected_count
+        
         if desc.HasField('default_value'):
             self.default = desc.default_value
            
@@ -232,8 +253,31 @@ class Field:
             raise Exception("Field %s is defined as static, but max_size or "
                             "max_count is not given." % self.name)
         
+        if field_options.type == nanopb_pb2.FT_VIEW:
+            if desc.type not in [FieldD.TYPE_STRING, FieldD.TYPE_BYTES]:
+                raise Exception("Field %s is defined as view, but only string "
+                                "and bytes fields can be views." % self.name)
+            if self.rules == 'REPEATED' and self.max_count is None:
+                raise Exception("Field %s is defined as view, but max_count "
+                                "is not given." % self.name)
+        
+        if field_options.lazy:
+            if desc.type != FieldD.TYPE_MESSAGE:
+                raise Exception("Field %s is defined as lazy, but only "
+                                "submessage fields can be lazy." % self.name)
+            if field_options.type != nanopb_pb2.FT_STATIC:
+                raise Exception("Field %s is defined as lazy, but it is not "
+                                "a static field." % self.name)
+            self.lazy = True
+        
         if field_options.type == nanopb_pb2.FT_STATIC:
             self.allocation = 'STATIC'
+        elif field_options.type == nanopb_pb2.FT_VIEW:
+            # Views are stored statically in the struct, only the data
+            # they point to lives outside of it.
+            self.allocation = 'STATIC'
+            self.pbtype = 'VIEW'
+            self.ctype = 'pb_view_t'
         elif field_options.type == nanopb_pb2.FT_POINTER:
             self.allocation = 'POINTER'
         elif field_options.type == nanopb_pb2.FT_CALLBACK:
@@ -256,6 +300,8 @@ class Field:
             if self.default is not None:
                 self.default = self.ctype + self.default
             self.enc_size = 5 # protoc rejects enum values > 32 bits
+        elif self.ctype == 'pb_view_t':
+            pass
         elif desc.type == FieldD.TYPE_STRING:
             self.pbtype = 'STRING'
             self.ctype = 'char'
@@ -277,6 +323,11 @@ class Field:
         else:
             raise NotImplementedError(desc.type)
         
+        if self.lazy:
+            # Lazy submessages are stored as a view to the encoded data.
+            self.pbtype = 'VIEW'
+            self.ctype = 'pb_view_t'
+        
     def __cmp__(self, other):
         return cmp(self.tag, other.tag)
     
@@ -336,6 +387,8 @@ class Field:
                 inner_init = '""'
             elif self.pbtype == 'BYTES':
                 inner_init = '{0, {0}}'
+            elif self.pbtype == 'VIEW':
+                inner_init = '{NULL, 0}'
             elif self.pbtype == 'ENUM':
                 inner_init = '(%s)0' % self.ctype
             else:
@@ -403,6 +456,8 @@ class Field:
         elif self.pbtype == 'BYTES':
             if self.allocation != 'STATIC':
                 return None # Not implemented
+        elif self.pbtype == 'VIEW':
+            return None # Not implemented
         
         if declaration_only:
             return 'extern const %s %s_default%s;' % (ctype, self.struct_name + self.name, array_decl)
@@ -414,13 +469,372 @@ class Field:
         identifier = '%s_%s_tag' % (self.struct_name, self.name)
         return '#define %-40s %d\n' % (identifier, self.tag)
     
+    def lazy_accessor(self):
+        '''Return the #define for decoding a lazy submessage field.'''
+        if self.rules == 'REPEATED':
+            args = '(msg, index, dest)'
+            member = '%s[index]' % self.name
+        elif self.rules == 'ONEOF':
+            args = '(msg, dest)'
+            member = '%s.%s' % (self.union_name, self.name)
+        else:
+            args = '(msg, dest)'
+            member = self.name
+        identifier = '%s_%s_decode%s' % (self.struct_name, self.name, args)
+        return '#define %-40s pb_decode_view(&(msg)->%s, %s_fields, dest)\n' % (
+            identifier, member, self.submsgname)
+    
+    def decoder_supported(self):
+        '''Check if a generated decoding function can handle this field.'''
+        return self.allocation == 'STATIC' and self.pbtype != 'VIEW'
+    
+    def decoder_target(self):
+        '''Expression for the field data in the generated decoding function.'''
+        if self.rules == 'ONEOF':
+            return 'dest->%s.%s' % (self.union_name, self.name)
+        else:
+            return 'dest->%s' % self.name
+    
+    def decoder_init_value(self, target):
+        '''Return the statements that set the field data to its default value.'''
+        if self.pbtype == 'MESSAGE':
+            return ['%s_set_defaults(&%s);' % (self.submsgname, target)]
+        elif self.pbtype in ['STRING', 'BYTES']:
+            if self.default is None:
+                return ['memset(&%s, 0, sizeof(%s));' % (target, target)]
+            return ['{',
+                    '    static const %s init%s = %s;' % (self.ctype,
+                        '[%d]' % self.max_size if self.pbtype == 'STRING' else '',
+                        self.get_initializer(False, True)),
+                    '    memcpy(&%s, &init, sizeof(init));' % target,
+                    '}']
+        else:
+            return ['%s = %s;' % (target, self.get_initializer(False, True))]
+    
+    def decoder_init(self):
+        '''Return the statements that initialize the field in the generated
+        decoding function, the same way as pb_decode() does.'''
+        if self.rules == 'REPEATED':
+            return ['dest->%s_count = 0;' % self.name]
+        elif self.rules == 'OPTIONAL':
+            return (['dest->has_%s = false;' % self.name] +
+                    self.decoder_init_value(self.decoder_target()))
+        else:
+            return self.decoder_init_value(self.decoder_target())
+    
+    def decoder_read(self, target, stream, fail, error):
+        '''Return the statements that decode one value into target.
+        fail is the statement to use when a decoding function fails, and
+        error(msg) returns the statement for reporting an error.'''
+        is64 = self.ctype in ['int64_t', 'uint64_t']
+        if self.pbtype in ['INT32', 'INT64', 'ENUM', 'BOOL']:
+            result = ['{',
+                      '    uint64_t value;',
+                      '    if (!pb_decode_varint(%s, &value))' % stream,
+                      '        ' + fail]
+            if self.pbtype == 'BOOL':
+                # Stored in the same way as pb_dec_varint() does it, as an
+                # integer of the size of the bool type.
+                result = ['{',
+                          '    uint64_t value;',
+                          '    int64_t svalue, clamped;',
+                          '    void *ptr = &%s;' % target,
+                          '    if (!pb_decode_varint(%s, &value))' % stream,
+                          '        ' + fail,
+                          '    if (sizeof(%s) == sizeof(int64_t))' % target,
+                          '        svalue = (int64_t)value;',
+                          '    else',
+                          '        svalue = (int32_t)value;',
+                          '    switch (sizeof(%s))' % target,
+                          '    {',
+                          '        case 1: clamped = *(int8_t*)ptr = (int8_t)svalue; break;',
+                          '        case 2: clamped = *(int16_t*)ptr = (int16_t)svalue; break;',
+                          '        case 4: clamped = *(int32_t*)ptr = (int32_t)svalue; break;',
+                          '        default: clamped = *(int64_t*)ptr = svalue; break;',
+                          '    }',
+                          '    if (clamped != svalue)',
+                          '        ' + error('integer too large')]
+            elif is64:
+                result += ['    %s = (%s)value;' % (target, self.ctype)]
+            else:
+                result += ['    %s = (%s)(int32_t)value;' % (target, self.ctype),
+                           '    if ((int64_t)%s != (int64_t)(int32_t)value)' % target,
+                           '        ' + error('integer too large')]
+            return result + ['}']
+        elif self.pbtype in ['UINT32', 'UINT64']:
+            result = ['{',
+                      '    uint64_t value;',
+                      '    if (!pb_decode_varint(%s, &value))' % stream,
+                      '        ' + fail,
+                      '    %s = (%s)value;' % (target, self.ctype)]
+            if not is64:
+                result += ['    if ((uint64_t)%s != value)' % target,
+                           '        ' + error('integer too large')]
+            return result + ['}']
+        elif self.pbtype in ['SINT32', 'SINT64']:
+            result = ['{',
+                      '    int64_t value;',
+                      '    if (!pb_decode_svarint(%s, &value))' % stream,
+                      '        ' + fail,
+                      '    %s = (%s)value;' % (target, self.ctype)]
+            if not is64:
+                result += ['    if ((int64_t)%s != value)' % target,
+                           '        ' + error('integer too large')]
+            return result + ['}']
+        elif self.pbtype in ['FIXED32', 'SFIXED32', 'FLOAT']:
+            return ['if (!pb_decode_fixed32(%s, &%s))' % (stream, target),
+                    '    ' + fail]
+        elif self.pbtype in ['FIXED64', 'SFIXED64', 'DOUBLE']:
+            return ['if (!pb_decode_fixed64(%s, &%s))' % (stream, target),
+                    '    ' + fail]
+        elif self.pbtype == 'STRING':
+            return ['{',
+                    '    uint64_t size;',
+                    '    if (!pb_decode_varint(%s, &size))' % stream,
+                    '        ' + fail,
+                    '    if (size >= sizeof(%s))' % target,
+                    '        ' + error('string overflow'),
+                    '    if (!pb_read(%s, (uint8_t*)%s, (size_t)size))' % (stream, target),
+                    '        ' + fail,
+                    '    %s[(size_t)size] = \'\\0\';' % target,
+                    '}']
+        elif self.pbtype == 'BYTES':
+            return ['{',
+                    '    uint64_t size;',
+                    '    if (!pb_decode_varint(%s, &size))' % stream,
+                    '        ' + fail,
+                    '    if (size > PB_SIZE_MAX)',
+                    '        ' + error('bytes overflow'),
+                    '    if (PB_BYTES_ARRAY_T_ALLOCSIZE(size) > sizeof(%s))' % target,
+                    '        ' + error('bytes overflow'),
+                    '    %s.size = (pb_size_t)size;' % target,
+                    '    if (!pb_read(%s, %s.bytes, (size_t)size))' % (stream, target),
+                    '        ' + fail,
+                    '}']
+        elif self.pbtype == 'MESSAGE':
+            # Array items are initialized here, other submessages were
+            # initialized together with the parent message.
+            if self.rules == 'REPEATED':
+                func = '%s_decode' % self.submsgname
+            else:
+                func = '%s_decode_noinit' % self.submsgname
+            return ['{',
+                    '    pb_istream_t substream;',
+                    '    bool status;',
+                    '    if (!pb_make_string_substream(%s, &substream))' % stream,
+                    '        ' + fail,
+                    '    status = %s(&substream, &%s);' % (func, target),
+                    '    pb_close_string_substream(%s, &substream);' % stream,
+                    '    if (!status)',
+                    '        ' + fail,
+                    '}']
+        else:
+            raise NotImplementedError(self.pbtype)
+    
+    def wire_type(self):
+        '''Return the wire type number of the field data.'''
+        if self.pbtype in ['FIXED64', 'SFIXED64', 'DOUBLE']:
+            return 1
+        elif self.pbtype in ['STRING', 'BYTES', 'MESSAGE', 'VIEW']:
+            return 2
+        elif self.pbtype in ['FIXED32', 'SFIXED32', 'FLOAT']:
+            return 5
+        else:
+            return 0
+    
+    def encoder_write(self, target, stream, encoders):
+        '''Return the statements that encode one value from target, without
+        the tag. encoders is the set of message names that have a generated
+        encoding function.'''
+        if self.pbtype in ['INT32', 'INT64', 'ENUM', 'BOOL']:
+            return ['if (!pb_encode_varint(%s, (uint64_t)(int64_t)%s))' % (stream, target),
+                    '    return false;']
+        elif self.pbtype in ['UINT32', 'UINT64']:
+            return ['if (!pb_encode_varint(%s, (uint64_t)%s))' % (stream, target),
+                    '    return false;']
+        elif self.pbtype in ['SINT32', 'SINT64']:
+            return ['if (!pb_encode_svarint(%s, (int64_t)%s))' % (stream, target),
+                    '    return false;']
+        elif self.pbtype in ['FIXED32', 'SFIXED32', 'FLOAT']:
+            return ['if (!pb_encode_fixed32(%s, &%s))' % (stream, target),
+                    '    return false;']
+        elif self.pbtype in ['FIXED64', 'SFIXED64', 'DOUBLE']:
+            return ['if (!pb_encode_fixed64(%s, &%s))' % (stream, target),
+                    '    return false;']
+        elif self.pbtype == 'STRING':
+            return ['{',
+                    '    size_t size = 0;',
+                    '    while (size < sizeof(%s) && %s[size] != \'\\0\')' % (target, target),
+                    '        size++;',
+                    '    if (!pb_encode_string(%s, (const uint8_t*)%s, size))' % (stream, target),
+                    '        return false;',
+                    '}']
+        elif self.pbtype == 'BYTES':
+            return ['if (PB_BYTES_ARRAY_T_ALLOCSIZE(%s.size) > sizeof(%s))' % (target, target),
+                    '    PB_RETURN_ERROR(%s, "bytes size exceeded");' % stream,
+                    'if (!pb_encode_string(%s, %s.bytes, %s.size))' % (stream, target, target),
+                    '    return false;']
+        elif self.pbtype == 'MESSAGE':
+            if str(self.submsgname) in encoders:
+                return ['if (!pb_encode_submessage_func(%s, &%s_encode_fields, &%s))' % (
+                            stream, self.submsgname, target),
+                        '    return false;']
+            else:
+                return ['if (!pb_encode_submessage(%s, %s_fields, &%s))' % (
+                            stream, self.submsgname, target),
+                        '    return false;']
+        else:
+            raise NotImplementedError(self.pbtype)
+    
+    def encoder_field(self, index, encoders):
+        '''Return the statements that encode this field in the generated
+        encoding function. index is the position of the field in the
+        pb_field_t array.'''
+        if self.allocation != 'STATIC' or self.pbtype == 'VIEW':
+            # Encode through the field descriptor
+            if self.rules == 'ONEOF':
+                target = 'src->%s.%s' % (self.union_name, self.name)
+            else:
+                target = 'src->%s' % self.name
+            return ['if (!pb_encode_field(stream, &%s_fields[%d], &%s))' % (
+                        self.struct_name, index, target),
+                    '    return false;']
+        
+        tag, taglen = encoded_tag(self.tag, self.wire_type())
+        write_tag = ['if (!pb_write(stream, (const uint8_t*)%s, %d))' % (tag, taglen),
+                     '    return false;']
+        
+        if self.rules == 'REQUIRED':
+            return write_tag + self.encoder_write('src->%s' % self.name, 'stream', encoders)
+        elif self.rules == 'OPTIONAL':
+            body = write_tag + self.encoder_write('src->%s' % self.name, 'stream', encoders)
+            return (['if (src->has_%s)' % self.name, '{'] +
+                    ['    ' + l for l in body] + ['}'])
+        elif self.rules == 'ONEOF':
+            target = 'src->%s.%s' % (self.union_name, self.name)
+            body = write_tag + self.encoder_write(target, 'stream', encoders)
+            return (['if (src->which_%s == %d)' % (self.union_name, self.tag), '{'] +
+                    ['    ' + l for l in body] + ['}'])
+        
+        # Repeated field
+        count = 'src->%s_count' % self.name
+        item = 'src->%s[i]' % self.name
+        body = ['if (%s > %d)' % (count, self.max_count),
+                '    PB_RETURN_ERROR(stream, "array max size exceeded");']
+        
+        if self.pbtype in ['STRING', 'BYTES', 'MESSAGE']:
+            body += ['for (i = 0; i < %s; i++)' % count, '{']
+            body += ['    ' + l for l in write_tag + self.encoder_write(item, 'stream', encoders)]
+            body += ['}']
+        else:
+            # Packed array, written the same way as by pb_encode()
+            tag, taglen = encoded_tag(self.tag, 2)
+            body += ['if (!pb_write(stream, (const uint8_t*)%s, %d))' % (tag, taglen),
+                     '    return false;']
+            if self.wire_type() == 5:
+                body += ['size = 4 * (size_t)%s;' % count]
+            elif self.wire_type() == 1:
+                body += ['size = 8 * (size_t)%s;' % count]
+            else:
+                body += ['{',
+                         '    pb_ostream_t sizestream = PB_OSTREAM_SIZING;',
+                         '    for (i = 0; i < %s; i++)' % count,
+                         '    {']
+                body += ['        ' + l for l in self.encoder_write(item, '&sizestream', encoders)]
+                body += ['    }',
+                         '    size = sizestream.bytes_written;',
+                         '}']
+            body += ['if (!pb_encode_varint(stream, (uint64_t)size))',
+                     '    return false;',
+                     'if (stream->callback == NULL)',
+                     '{',
+                     '    if (!pb_write(stream, NULL, size)) /* Just sizing */',
+                     '        return false;',
+                     '}',
+                     'else',
+                     '{',
+                     '    for (i = 0; i < %s; i++)' % count,
+                     '    {']
+            body += ['        ' + l for l in self.encoder_write(item, 'stream', encoders)]
+            body += ['    }',
+                     '}']
+        
+        return (['if (%s > 0)' % count, '{'] +
+                ['    ' + l for l in body] + ['}'])
+    
+    def decoder_case(self, required_bit):
+        '''Return the statements for decoding this field in the switch of
+        the generated decoding function. required_bit is the bit to set in
+        the seen mask, or None.'''
+        result = ['case %d: /* %s */' % (self.tag, self.name)]
+        body = []
+        fail = 'return false;'
+        error = lambda msg: 'PB_RETURN_ERROR(stream, "%s");' % msg
+        
+        if self.rules == 'REPEATED':
+            item = 'dest->%s[dest->%s_count]' % (self.name, self.name)
+            count = 'dest->%s_count' % self.name
+            single = (['if (%s >= %d)' % (count, self.max_count),
+                       '    ' + error('array overflow')] +
+                      self.decoder_read(item, 'stream', fail, error) +
+                      ['%s++;' % count])
+            
+            if self.pbtype in ['STRING', 'BYTES', 'MESSAGE']:
+                body += single
+            else:
+                packed_fail = '{ status = false; break; }'
+                packed_error = lambda msg: '{ PB_SET_ERROR(&substream, "%s"); status = false; break; }' % msg
+                body += ['if (wire_type == PB_WT_STRING)',
+                         '{',
+                         '    /* Packed array */',
+                         '    pb_istream_t substream;',
+                         '    bool status = true;',
+                         '    if (!pb_make_string_substream(stream, &substream))',
+                         '        return false;',
+                         '    while (substream.bytes_left > 0 && %s < %d)' % (count, self.max_count),
+                         '    {']
+                body += ['        ' + l for l in self.decoder_read(item, '&substream', packed_fail, packed_error)]
+                body += ['        %s++;' % count,
+                         '    }',
+                         '    pb_close_string_substream(stream, &substream);',
+                         '    if (!status)',
+                         '        return false;',
+                         '    if (substream.bytes_left != 0)',
+                         '        ' + error('array overflow'),
+                         '}',
+                         'else',
+                         '{']
+                body += ['    ' + l for l in single]
+                body += ['}']
+        elif self.rules == 'ONEOF':
+            body += ['dest->which_%s = %d;' % (self.union_name, self.tag)]
+            if self.pbtype == 'MESSAGE':
+                body += ['memset(&%s, 0, sizeof(%s));' % (self.decoder_target(), self.decoder_target())]
+                body += self.decoder_init_value(self.decoder_target())
+            body += self.decoder_read(self.decoder_target(), 'stream', fail, error)
+        else:
+            if self.rules == 'OPTIONAL':
+                body += ['dest->has_%s = true;' % self.name]
+            elif required_bit is not None:
+                body += ['seen |= 0x%xu;' % required_bit]
+            body += self.decoder_read(self.decoder_target(), 'stream', fail, error)
+        
+        result += ['    ' + l for l in body]
+        result += ['    break;']
+        return result
+    
     def pb_field_t(self, prev_field_name):
         '''Return the pb_field_t initializer to use in the constant array.
         prev_field_name is the name of the previous field or None.
         '''
 
+        expect = (self.allocation == 'POINTER' and self.rules == 'REPEATED'
+                  and self.expected_count)
+
         if self.rules == 'ONEOF':
             result = '    PB_ONEOF_FIELD(%s, ' % self.union_name
+        elif expect:
+            result = '    PB_FIELD_EXPECT('
         else:
             result = '    PB_FIELD('
 
@@ -439,11 +853,16 @@ class Field:
             result += '0)'
         elif self.pbtype in ['BYTES', 'STRING'] and self.allocation != 'STATIC':
             result += '0)' # Arbitrary size default values not implemented
+        elif self.pbtype == 'VIEW':
+            result += '0)' # Default values for views not implemented
         elif self.rules == 'OPTEXT':
             result += '0)' # Default value for extensions is not implemented
         else:
             result += '&%s_default)' % (self.struct_name + self.name)
         
+        if expect:
+            result = result[:-1] + ', %d)' % self.expected_count
+        
         return result
     
     def largest_field_value(self):
@@ -457,14 +876,14 @@ class Field:
             else:
                 return 'pb_membersize(%s, %s)' % (self.struct_name, self.name)
 
-        return max(self.tag, self.max_size, self.max_count)        
+        return max(self.tag, self.max_size, self.max_count, self.expected_count)
 
     def encoded_size(self, allmsgs):
         '''Return the maximum size that this field can take when encoded,
         including the field tag. If the size cannot be determined, returns
         None.'''
         
-        if self.allocation != 'STATIC':
+        if self.allocation != 'STATIC' or self.pbtype == 'VIEW':
             return None
         
         if self.pbtype == 'MESSAGE':
@@ -523,6 +942,8 @@ class ExtensionRange(Field):
         self.default = None
         self.max_size = 0
         self.max_count = 0
+        self.expected_count = None
+        self.lazy = False
         
     def __str__(self):
         return '    pb_extension_t *extensions;'
@@ -650,6 +1071,9 @@ class OneOf(Field):
     def largest_field_value(self):
         return max([f.largest_field_value() for f in self.fields])
 
+    def decoder_init(self):
+        return ['dest->which_%s = 0;' % self.name]
+
     def encoded_size(self, allmsgs):
         largest = EncodedSize(0)
         for f in self.fields:
@@ -711,6 +1135,11 @@ class Message:
                 self.fields.append(ExtensionRange(self.name, range_start, field_options))
         
         self.packed = message_options.packed_struct
+        self.field_index = message_options.field_index
+        self.generate_decoder = message_options.generate_decoder
+        self.generate_encoder = message_options.generate_encoder
+        self.decoder = False
+        self.default_image = False
         self.ordered_fields = self.fields[:]
         self.ordered_fields.sort()
 
@@ -781,12 +1210,276 @@ class Message:
                 count += 1
         return count
 
+    def all_fields(self):
+        '''Returns the fields in the same order as in the pb_field_t array,
+        with oneofs expanded to their member fields.'''
+        result = []
+        for field in self.ordered_fields:
+            if isinstance(field, OneOf):
+                result += field.fields
+            else:
+                result.append(field)
+        return result
+
+    def field_indexes(self):
+        '''Returns the #defines for the index of each field in the pb_field_t
+        array and the total number of fields.'''
+        result = ''
+        fields = self.all_fields()
+        for i, field in enumerate(fields):
+            identifier = '%s_%s_index' % (self.name, field.name)
+            result += '#define %-40s %d\n' % (identifier, i)
+        identifier = '%s_fields_count' % self.name
+        result += '#define %-40s %d\n' % (identifier, len(fields))
+        return result
+
+    def default_image_candidate(self):
+        '''Check if the structure can be initialized by copying an image of
+        its default values. Static submessages are checked separately.'''
+        if not self.field_index:
+            return False
+        for field in self.all_fields():
+            if field.allocation == 'CALLBACK':
+                return False
+        return True
+    
+    def decoder_candidate(self):
+        '''Check if the fields of this message allow a generated decoding
+        function. Submessages are checked separately.'''
+        if not self.generate_decoder:
+            return False
+        if self.count_required_fields() > 32:
+            return False
+        for field in self.all_fields():
+            if not field.decoder_supported():
+                return False
+        return True
+    
+    def decoder_declaration(self):
+        '''Return the prototypes of the generated decoding functions.'''
+        return ('bool %s_decode(pb_istream_t *stream, %s *dest);\n' % (self.name, self.name) +
+                'bool %s_decode_noinit(pb_istream_t *stream, %s *dest);\n' % (self.name, self.name))
+    
+    def decoder_definition(self):
+        '''Return the generated decoding functions. They give the same
+        results as pb_decode() and pb_decode_noinit() with the field
+        descriptors, but decode each field with code specific to it.'''
+        lines = []
+        
+        lines += ['static void %s_set_defaults(%s *dest)' % (self.name, self.name), '{']
+        init = []
+        if self.default_image:
+            init = ['memcpy(dest, &%s_default_image, sizeof(%s));' % (self.name, self.name)]
+        else:
+            for field in self.ordered_fields:
+                init += field.decoder_init()
+        if not init:
+            init = ['PB_UNUSED(dest);']
+        lines += ['    ' + l for l in init]
+        lines += ['}', '']
+        
+        required = [f for f in self.all_fields() if f.rules == 'REQUIRED']
+        lines += ['bool %s_decode_noinit(pb_istream_t *stream, %s *dest)' % (self.name, self.name), '{']
+        if required:
+            lines += ['    uint32_t seen = 0;', '    ']
+        if not self.all_fields():
+            lines += ['    PB_UNUSED(dest);', '    ']
+        lines += ['    while (stream->bytes_left)',
+                  '    {',
+                  '        uint32_t tag;',
+                  '        pb_wire_type_t wire_type;',
+                  '        bool eof;',
+                  '        ',
+                  '        if (!pb_decode_tag(stream, &wire_type, &tag, &eof))',
+                  '        {',
+                  '            if (eof)',
+                  '                break;',
+                  '            return false;',
+                  '        }',
+                  '        ',
+                  '        switch (tag)',
+                  '        {']
+        for field in self.all_fields():
+            bit = None
+            if field in required:
+                bit = 1 << required.index(field)
+            lines += ['            ' + l for l in field.decoder_case(bit)]
+            lines += ['            ']
+        lines += ['            default:',
+                  '                if (!pb_skip_field(stream, wire_type))',
+                  '                    return false;',
+                  '                break;',
+                  '        }',
+                  '    }',
+                  '    ']
+        if required:
+            lines += ['    if (seen != 0x%xu)' % ((1 << len(required)) - 1),
+                      '        PB_RETURN_ERROR(stream, "missing required field");',
+                      '    ']
+        lines += ['    return true;', '}', '']
+        
+        lines += ['bool %s_decode(pb_istream_t *stream, %s *dest)' % (self.name, self.name),
+                  '{',
+                  '    %s_set_defaults(dest);' % self.name,
+                  '    return %s_decode_noinit(stream, dest);' % self.name,
+                  '}']
+        
+        return '\n'.join(lines) + '\n'
+
+    def encoder_declaration(self):
+        '''Return the prototypes of the generated encoding functions.'''
+        return ('bool %s_encode(pb_ostream_t *stream, const %s *src);\n' % (self.name, self.name) +
+                'bool %s_encode_delimited(pb_ostream_t *stream, const %s *src);\n' % (self.name, self.name))
+    
+    def encoder_definition(self, encoders):
+        '''Return the generated encoding functions. They write the same
+        bytes as pb_encode() and pb_encode_delimited() with the field
+        descriptors. encoders is the set of message names in this file
+        that have generated encoding functions.'''
+        fields = self.all_fields()
+        lines = ['static bool %s_encode_fields(pb_ostream_t *stream, const void *src_struct)' % self.name,
+                 '{']
+        
+        if not fields:
+            lines += ['    PB_UNUSED(stream);',
+                      '    PB_UNUSED(src_struct);']
+        else:
+            lines += ['    const %s *src = (const %s*)src_struct;' % (self.name, self.name)]
+            if [f for f in fields if f.rules == 'REPEATED' and f.allocation == 'STATIC']:
+                lines += ['    size_t i;']
+            if [f for f in fields if f.rules == 'REPEATED' and f.allocation == 'STATIC'
+                and f.pbtype not in ['STRING', 'BYTES', 'MESSAGE']]:
+                lines += ['    size_t size;']
+        lines += ['    ']
+        
+        # The field list starts with the pb_msginfo_t entry, if any
+        first = 1 if self.field_index else 0
+        for index, field in enumerate(fields):
+            lines += ['    /* %s */' % field.name]
+            lines += ['    ' + l for l in field.encoder_field(first + index, encoders)]
+            lines += ['    ']
+        
+        lines += ['    return true;', '}', '']
+        lines += ['bool %s_encode(pb_ostream_t *stream, const %s *src)' % (self.name, self.name),
+                  '{',
+                  '    return %s_encode_fields(stream, src);' % self.name,
+                  '}',
+                  '',
+                  'bool %s_encode_delimited(pb_ostream_t *stream, const %s *src)' % (self.name, self.name),
+                  '{',
+                  '    return pb_encode_submessage_func(stream, &%s_encode_fields, src);' % self.name,
+                  '}']
+        return '\n'.join(lines) + '\n'
+
+    def tag_index(self):
+        '''Builds the table for finding fields by tag number.
+        Returns tuple (table, multiplier, shift). Multiplier is 0 for a dense
+        table that is indexed directly by tag number. Otherwise the table
+        is indexed by the perfect hash ((tag * multiplier) mod 2**32) >> shift.
+        Returns None if there are no fields, or if no hash was found and a
+        dense table would be too large. The fields are then searched linearly.
+        '''
+        entries = [(f.tag, i + 1) for i, f in enumerate(self.all_fields())
+                   if not isinstance(f, ExtensionRange)]
+        if not entries:
+            return None
+
+        max_tag = max([tag for tag, entry in entries])
+        bits = 1
+        while (1 << bits) < len(entries):
+            bits += 1
+
+        # Use a hash table only if the dense table would be much larger.
+        if max_tag + 1 > max(2 << bits, 16):
+            for hashbits in range(bits, bits + 4):
+                shift = 32 - hashbits
+                for k in range(1, 256):
+                    mult = ((0x9E3779B1 * k) & 0xFFFFFFFF) | 1
+                    slots = [((tag * mult) & 0xFFFFFFFF) >> shift for tag, entry in entries]
+                    if len(set(slots)) == len(entries):
+                        table = [0] * (1 << hashbits)
+                        for slot, (tag, entry) in zip(slots, entries):
+                            table[slot] = entry
+                        return table, mult, shift
+
+        # The dense table has one entry per tag number, so only use it if
+        # it stays small compared to the number of fields.
+        if max_tag + 1 > max(4 * len(entries), 16):
+            return None
+
+        table = [0] * (max_tag + 1)
+        for tag, entry in entries:
+            table[tag] = entry
+        return table, 0, 0
+
+    def info_definition(self):
+        '''Returns the definition of the pb_msginfo_t lookup tables.'''
+        result = ''
+        index = self.tag_index()
+        if index is None:
+            index_init = 'NULL, 0, 0, 0'
+        else:
+            table, mult, shift = index
+            result += 'static const pb_size_t %s_tag_index[%d] = {' % (self.name, len(table))
+            for i, entry in enumerate(table):
+                if i % 16 == 0:
+                    result += '\n    '
+                result += '%d%s' % (entry, ', ' if i + 1 < len(table) else '')
+            result += '\n};\n\n'
+            if mult:
+                index_init = '%s_tag_index, %d, 0x%08xu, %d' % (self.name, len(table), mult, shift)
+            else:
+                index_init = '%s_tag_index, %d, 0, 0' % (self.name, len(table))
+
+        fields = self.all_fields()
+        if not [f for f in fields if f.rules == 'REQUIRED']:
+            required_index_init = 'NULL'
+        else:
+            result += 'static const pb_size_t %s_required_index[%d] = {' % (self.name, len(fields))
+            required = 0
+            for i, field in enumerate(fields):
+                if i % 16 == 0:
+                    result += '\n    '
+                result += '%d%s' % (required, ', ' if i + 1 < len(fields) else '')
+                if field.rules == 'REQUIRED':
+                    required += 1
+            result += '\n};\n\n'
+            required_index_init = '%s_required_index' % self.name
+
+        if self.default_image:
+            result += 'static const %s %s_default_image = %s_init_default;\n\n' % (self.name, self.name, self.name)
+            image_init = '&%s_default_image, sizeof(%s)' % (self.name, self.name)
+        else:
+            image_init = 'NULL, 0'
+
+        # Expected value of the last word of the required fields bitmask
+        required = len([f for f in fields if f.rules == 'REQUIRED'])
+        if required % 32:
+            required_init = '%d, 0x%08xu' % (required, (1 << (required % 32)) - 1)
+        else:
+            required_init = '%d, 0' % required
+
+        result += 'const pb_msginfo_t %s_info = {%s, %s, %s, %s};' % (self.name, index_init, required_index_init, required_init, image_init)
+        return result
+
+    def fields_array_size(self):
+        '''Number of entries in the pb_field_t array, including the
+        pb_msginfo_t entry and the terminator.'''
+        if self.field_index:
+            return self.count_all_fields() + 2
+        else:
+            return self.count_all_fields() + 1
+
     def fields_declaration(self):
-        result = 'extern const pb_field_t %s_fields[%d];' % (self.name, self.count_all_fields() + 1)
+        result = 'extern const pb_field_t %s_fields[%d];' % (self.name, self.fields_array_size())
+        if self.field_index:
+            result += '\nextern const pb_msginfo_t %s_info;' % self.name
         return result
 
     def fields_definition(self):
-        result = 'const pb_field_t %s_fields[%d] = {\n' % (self.name, self.count_all_fields() + 1)
+        result = 'const pb_field_t %s_fields[%d] = {\n' % (self.name, self.fields_array_size())
+        if self.field_index:
+            result += '    PB_MSGINFO_FIELD(&%s_info),\n' % self.name
         
         prev = None
         for field in self.ordered_fields:
@@ -885,6 +1578,46 @@ def parse_file(fdesc, file_options):
                         idx = enum.value_longnames.index(field.default)
                         field.default = enum.values[idx][0]
     
+    # The default image of a message includes its static submessages, so
+    # they must not have callback fields either.
+    images = set(str(m.name) for m in messages if m.default_image_candidate())
+    changed = True
+    while changed:
+        changed = False
+        for message in messages:
+            if str(message.name) not in images:
+                continue
+            for field in message.all_fields():
+                if (field.pbtype == 'MESSAGE' and field.allocation == 'STATIC'
+                        and str(field.submsgname) not in images):
+                    images.discard(str(message.name))
+                    changed = True
+                    break
+    
+    for message in messages:
+        message.default_image = str(message.name) in images
+    
+    # Generated decoding functions call the functions of their submessages,
+    # so a message can have one only if all its submessage types do.
+    decoders = set(str(m.name) for m in messages if m.decoder_candidate())
+    changed = True
+    while changed:
+        changed = False
+        for message in messages:
+            if str(message.name) not in decoders:
+                continue
+            for field in message.all_fields():
+                if field.pbtype == 'MESSAGE' and str(field.submsgname) not in decoders:
+                    decoders.discard(str(message.name))
+                    changed = True
+                    break
+    
+    for message in messages:
+        message.decoder = str(message.name) in decoders
+        if message.generate_decoder and not message.decoder:
+            sys.stderr.write('Warning: %s needs pb_decode(), because it has fields '
+                             'that the generated decoder does not support.\n' % message.name)
+    
     return enums, messages, extensions
 
 def toposort2(data):
@@ -954,7 +1687,7 @@ def generate_header(dependencies, headername, enums, messages, extensions, optio
         yield options.genformat % (noext + options.extension + '.h')
         yield '\n'
 
-    yield '#if PB_PROTO_HEADER_VERSION != 30\n'
+    yield '#if PB_PROTO_HEADER_VERSION != 31\n'
     yield '#error Regenerate this file with the current version of nanopb generator.\n'
     yield '#endif\n'
     yield '\n'
@@ -1000,6 +1733,33 @@ def generate_header(dependencies, headername, enums, messages, extensions, optio
         yield extension.tags()
     yield '\n'
     
+    yield '/* Field indexes (for use with pb_decode_projection) */\n'
+    for msg in sort_dependencies(messages):
+        yield msg.field_indexes()
+    yield '\n'
+    
+    lazy_fields = [f for msg in messages for f in msg.all_fields()
+                   if f.lazy]
+    if lazy_fields:
+        yield '/* Decoding of lazy submessage fields (needs pb_decode.h) */\n'
+        for field in lazy_fields:
+            yield field.lazy_accessor()
+        yield '\n'
+    
+    decoders = [msg for msg in messages if msg.decoder]
+    if decoders:
+        yield '/* Generated decoding functions (same results as pb_decode()) */\n'
+        for msg in decoders:
+            yield msg.decoder_declaration()
+        yield '\n'
+    
+    encoders = [msg for msg in messages if msg.generate_encoder]
+    if encoders:
+        yield '/* Generated encoding functions (same output as pb_encode()) */\n'
+        for msg in encoders:
+            yield msg.encoder_declaration()
+        yield '\n'
+    
     yield '/* Struct field encoding specification for nanopb */\n'
     for msg in messages:
         yield msg.fields_declaration() + '\n'
@@ -1057,9 +1817,22 @@ def generate_source(headername, enums, messages, extensions, options):
     else:
         yield '/* Generated by %s at %s. */\n\n' % (nanopb_version, time.asctime())
     yield options.genformat % (headername)
+    
+    decoders = [msg for msg in sort_dependencies(messages) if msg.decoder]
+    encoders = [msg for msg in sort_dependencies(messages) if msg.generate_encoder]
+    libraries = []
+    if decoders:
+        libraries.append('pb_decode.h')
+    if encoders:
+        libraries.append('pb_encode.h')
+    for library in libraries:
+        try:
+            yield options.libformat % (library)
+        except TypeError:
+            pass # Custom library include, assumed to cover the library
     yield '\n'
     
-    yield '#if PB_PROTO_HEADER_VERSION != 30\n'
+    yield '#if PB_PROTO_HEADER_VERSION != 31\n'
     yield '#error Regenerate this file with the current version of nanopb generator.\n'
     yield '#endif\n'
     yield '\n'
@@ -1070,10 +1843,23 @@ def generate_source(headername, enums, messages, extensions, options):
     yield '\n\n'
     
     for msg in messages:
+        if msg.field_index:
+            yield msg.info_definition() + '\n'
         yield msg.fields_definition() + '\n\n'
     
     for ext in extensions:
         yield ext.extension_def() + '\n'
+    
+    if decoders:
+        yield '\n/* Generated decoding functions */\n'
+        for msg in decoders:
+            yield msg.decoder_definition() + '\n'
+    
+    if encoders:
+        names = set(str(msg.name) for msg in encoders)
+        yield '\n/* Generated encoding functions */\n'
+        for msg in encoders:
+            yield msg.encoder_definition(names) + '\n'
         
     # Add checks for numeric limits
     if messages:
@@ -1099,6 +1885,12 @@ def generate_source(headername, enums, messages, extensions, options):
             elif status > worst:
                 worst = status
                 worst_field = str(field.struct_name) + '.' + str(field.name)
+        
+        # The lookup tables store field indexes as pb_size_t, starting from 1
+        entries = len(msg.all_fields()) + 1
+        if entries > worst:
+            worst = entries
+            worst_field = str(msg.name)
 
     if worst > 255 or checks:
         yield '\n/* Check that field information fits in pb_field_t */\n'
@@ -1137,6 +1929,15 @@ def generate_source(headername, enums, messages, extensions, options):
                 yield 'PB_STATIC_ASSERT((%s), YOU_MUST_DEFINE_PB_FIELD_16BIT_FOR_MESSAGES_%s)\n'%(assertion,msgs)
             yield '#endif\n\n'
     
+    # Add check for the field offsets, which are from the start of the structure
+    if messages:
+        assertion = ' && '.join('sizeof(%s) < 65536' % msg.name for msg in messages)
+        msgs = '_'.join(str(msg.name) for msg in messages)
+        yield '\n/* Check that field offsets fit in pb_field_t */\n'
+        yield '#if !defined(PB_FIELD_32BIT)\n'
+        yield 'PB_STATIC_ASSERT((%s), YOU_MUST_DEFINE_PB_FIELD_32BIT_FOR_MESSAGES_%s)\n' % (assertion, msgs)
+        yield '#endif\n'
+
     # Add check for sizeof(double)
     has_double = False
     for msg in messages:
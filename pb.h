@@ -13,6 +13,11 @@
 /* Enable support for dynamically allocated fields */
 /* #define PB_ENABLE_MALLOC 1 */
 
+/* Keep the extra capacity that was reserved while decoding repeated
+ * pointer fields, instead of shrinking the arrays to the final size.
+ * Saves a realloc() per array at the cost of some memory. */
+/* #define PB_NO_SHRINK_ARRAYS 1 */
+
 /* Define this if your CPU architecture is big endian, i.e. it
  * stores the most-significant byte first. */
 /* #define __BIG_ENDIAN__ 1 */
@@ -174,10 +179,19 @@ typedef uint8_t pb_type_t;
  * The field contains a pointer to pb_extension_t */
 #define PB_LTYPE_EXTENSION 0x08
 
+/* String or bytes referencing the input buffer
+ * The field is a pb_view_t pointing to the data inside the message. */
+#define PB_LTYPE_VIEW 0x09
+
 /* Number of declared LTYPES */
-#define PB_LTYPES_COUNT 9
+#define PB_LTYPES_COUNT 10
 #define PB_LTYPE_MASK 0x0F
 
+/* Pseudo-field at the start of a generated field list, which points to
+ * the pb_msginfo_t of the message. It is not a field, and not counted
+ * in PB_LTYPES_COUNT. */
+#define PB_LTYPE_MSGINFO 0x0A
+
 /**** Field repetition rules ****/
 
 #define PB_HTYPE_REQUIRED 0x00
@@ -214,6 +228,15 @@ typedef uint8_t pb_type_t;
     typedef int8_t pb_ssize_t;
 #endif
 
+/* Data type used for storing the offsets of struct fields. Structures
+ * larger than 64 kB require PB_FIELD_32BIT.
+ */
+#if defined(PB_FIELD_32BIT)
+    typedef uint32_t pb_offset_t;
+#else
+    typedef uint16_t pb_offset_t;
+#endif
+
 /* This structure is used in auto-generated constants
  * to specify struct fields.
  * You can change field sizes if you need structures
@@ -227,7 +250,7 @@ typedef struct pb_field_s pb_field_t;
 struct pb_field_s {
     pb_size_t tag;
     pb_type_t type;
-    pb_size_t data_offset; /* Offset of field data, relative to previous field. */
+    pb_offset_t data_offset; /* Offset of field data from start of structure */
     pb_ssize_t size_offset; /* Offset of array size or has-boolean, relative to data */
     pb_size_t data_size; /* Data size in bytes for a single item */
     pb_size_t array_size; /* Maximum number of entries in array */
@@ -254,6 +277,42 @@ PB_STATIC_ASSERT(sizeof(uint32_t) == 4, UINT32_T_WRONG_SIZE)
 PB_STATIC_ASSERT(sizeof(int64_t) == 8, INT64_T_WRONG_SIZE)
 PB_STATIC_ASSERT(sizeof(uint64_t) == 8, UINT64_T_WRONG_SIZE)
 
+/* Lookup tables for a message type, generated alongside the pb_field_t
+ * array. A pointer to this structure is stored in the ptr member of the
+ * PB_MSGINFO_FIELD() entry at the start of the array, so that it can be
+ * found without walking the list. Field lists without that entry work
+ * also, but are searched linearly.
+ */
+typedef struct pb_msginfo_s pb_msginfo_t;
+struct pb_msginfo_s {
+    /* Table for finding a field by its tag number. The entries are indexes
+     * to the pb_field_t array plus one, or 0 if there is no such field.
+     * If tag_mult is 0, the table is indexed directly by the tag number.
+     * Otherwise it is indexed by the hash (uint32_t)(tag * tag_mult) >> tag_shift.
+     * Can be NULL if no table has been generated. */
+    const pb_size_t *tag_index;
+    uint32_t tag_index_size;
+    uint32_t tag_mult;
+    uint8_t tag_shift;
+    
+    /* Number of required fields before each field, in the same order as
+     * the pb_field_t array. NULL if the message has no required fields. */
+    const pb_size_t *required_index;
+
+    /* Number of required fields, and the expected value of the last 32-bit
+     * word of the bitmask of seen required fields (0 if the count is a
+     * multiple of 32). Used to check for missing fields after decoding. */
+    pb_size_t required_count;
+    uint32_t required_mask;
+
+    /* Image of the structure with all fields set to their default values,
+     * and its size. The decoder initializes the structure by copying it.
+     * NULL if the message has callback fields, which must not be
+     * overwritten, either directly or in its static submessages. */
+    const void *default_image;
+    size_t struct_size;
+};
+
 /* This structure is used for 'bytes' arrays.
  * It has the number of bytes in the beginning, and after that an array.
  * Note that actual structs used will have a different length of bytes array.
@@ -267,6 +326,16 @@ struct pb_bytes_array_s {
 };
 typedef struct pb_bytes_array_s pb_bytes_array_t;
 
+/* This structure is used for string and bytes fields with FT_VIEW.
+ * Instead of copying the data, it points directly into the buffer the
+ * message was decoded from. The buffer must therefore outlive the message.
+ */
+typedef struct pb_view_s pb_view_t;
+struct pb_view_s {
+    const uint8_t *ptr;
+    pb_size_t size;
+};
+
 /* This structure is used for giving the callback function.
  * It is stored in the message structure and filled in by the method that
  * calls pb_decode.
@@ -376,7 +445,7 @@ struct pb_extension_s {
 #endif
 
 /* This is used to inform about need to regenerate .pb.h/.pb.c files. */
-#define PB_PROTO_HEADER_VERSION 30
+#define PB_PROTO_HEADER_VERSION 31
 
 /* These macros are used to declare pb_field_t's in the constant array. */
 /* Size of a structure member, in bytes. */
@@ -387,16 +456,21 @@ struct pb_extension_s {
 #define pb_delta(st, m1, m2) ((int)offsetof(st, m1) - (int)offsetof(st, m2))
 /* Marks the end of the field list */
 #define PB_LAST_FIELD {0,(pb_type_t) 0,0,0,0,0,0}
-
-/* Macros for filling in the data_offset field */
+/* Gives the pb_msginfo_t for the message, at the start of the field list */
+#define PB_MSGINFO_FIELD(info) {0,(pb_type_t) PB_LTYPE_MSGINFO,0,0,0,0,info}
+/* First actual field in a field list that may start with PB_MSGINFO_FIELD */
+#define PB_FIRST_FIELD(fields) \
+    (PB_LTYPE((fields)[0].type) == PB_LTYPE_MSGINFO ? (fields) + 1 : (fields))
+
+/* Macros for filling in the data_offset field. The offset is from the start
+ * of the structure for all fields, so that any field can be accessed
+ * directly. The previous field m2 is no longer used. */
 /* data_offset for first field in a message */
 #define PB_DATAOFFSET_FIRST(st, m1, m2) (offsetof(st, m1))
 /* data_offset for subsequent fields */
-#define PB_DATAOFFSET_OTHER(st, m1, m2) (offsetof(st, m1) - offsetof(st, m2) - pb_membersize(st, m2))
+#define PB_DATAOFFSET_OTHER(st, m1, m2) (offsetof(st, m1))
 /* Choose first/other based on m1 == m2 (deprecated, remains for backwards compatibility) */
-#define PB_DATAOFFSET_CHOOSE(st, m1, m2) (int)(offsetof(st, m1) == offsetof(st, m2) \
-                                  ? PB_DATAOFFSET_FIRST(st, m1, m2) \
-                                  : PB_DATAOFFSET_OTHER(st, m1, m2))
+#define PB_DATAOFFSET_CHOOSE(st, m1, m2) (offsetof(st, m1))
 
 /* Required fields are the simplest. They just have delta (padding) from
  * previous field end, and the size of the field. Pointer is used for
@@ -437,6 +511,13 @@ struct pb_extension_s {
     fd, pb_delta(st, m ## _count, m), \
     pb_membersize(st, m[0]), 0, ptr}
 
+/* The array_size of repeated pointer fields is the expected number of
+ * entries, used for reserving space in the decoder. 0 means unknown. */
+#define PB_REPEATED_POINTER_EXPECT(tag, st, m, fd, ltype, ptr, count) \
+    {tag, PB_ATYPE_POINTER | PB_HTYPE_REPEATED | ltype, \
+    fd, pb_delta(st, m ## _count, m), \
+    pb_membersize(st, m[0]), count, ptr}
+
 /* Callbacks are much like required fields except with special datatype. */
 #define PB_REQUIRED_CALLBACK(tag, st, m, fd, ltype, ptr) \
     {tag, PB_ATYPE_CALLBACK | PB_HTYPE_REQUIRED | ltype, \
@@ -482,6 +563,7 @@ struct pb_extension_s {
 #define PB_LTYPE_MAP_UINT32     PB_LTYPE_UVARINT
 #define PB_LTYPE_MAP_UINT64     PB_LTYPE_UVARINT
 #define PB_LTYPE_MAP_EXTENSION  PB_LTYPE_EXTENSION
+#define PB_LTYPE_MAP_VIEW       PB_LTYPE_VIEW
 
 /* This is the actual macro used in field descriptions.
  * It takes these arguments:
@@ -503,6 +585,13 @@ struct pb_extension_s {
         PB_DATAOFFSET_ ## placement(message, field, prevfield), \
         PB_LTYPE_MAP_ ## type, ptr)
 
+/* Same as PB_FIELD, with the expected number of entries for a repeated
+ * pointer field. Generated when the expected_count option is given. */
+#define PB_FIELD_EXPECT(tag, type, rules, allocation, placement, message, field, prevfield, ptr, count) \
+        PB_ ## rules ## _ ## allocation ## _EXPECT(tag, message, field, \
+        PB_DATAOFFSET_ ## placement(message, field, prevfield), \
+        PB_LTYPE_MAP_ ## type, ptr, count)
+
 /* Field description for oneof fields. This requires taking into account the
  * union name also, that's why a separate set of macros is needed.
  */
@@ -537,7 +626,7 @@ struct pb_extension_s {
 #define PB_SET_ERROR(stream, msg) PB_UNUSED(stream)
 #define PB_GET_ERROR(stream) "(errmsg disabled)"
 #else
-#define PB_SET_ERROR(stream, msg) (stream->errmsg = (stream)->errmsg ? (stream)->errmsg : (msg))
+#define PB_SET_ERROR(stream, msg) ((stream)->errmsg = (stream)->errmsg ? (stream)->errmsg : (msg))
 #define PB_GET_ERROR(stream) ((stream)->errmsg ? (stream)->errmsg : "(none)")
 #endif
 
@@ -5,14 +5,32 @@
 
 #include "pb_common.h"
 
+/* Move the iterator back to the first field. */
+static void pb_field_iter_rewind(pb_field_iter_t *iter)
+{
+    iter->pos = iter->start;
+    iter->required_field_index = 0;
+    iter->pData = (char*)iter->dest_struct + iter->pos->data_offset;
+    iter->pSize = (char*)iter->pData + iter->pos->size_offset;
+}
+
 bool pb_field_iter_begin(pb_field_iter_t *iter, const pb_field_t *fields, void *dest_struct)
 {
+    /* The lookup tables are given by the first entry, if the generator
+     * has provided them. */
+    if (PB_LTYPE(fields->type) == PB_LTYPE_MSGINFO)
+    {
+        iter->info = (const pb_msginfo_t*)fields->ptr;
+        fields++;
+    }
+    else
+    {
+        iter->info = NULL;
+    }
+    
     iter->start = fields;
-    iter->pos = fields;
-    iter->required_field_index = 0;
     iter->dest_struct = dest_struct;
-    iter->pData = (char*)dest_struct + iter->pos->data_offset;
-    iter->pSize = (char*)iter->pData + iter->pos->size_offset;
+    pb_field_iter_rewind(iter);
     
     return (iter->pos->tag != 0);
 }
@@ -33,52 +51,67 @@ bool pb_field_iter_next(pb_field_iter_t *iter)
     if (iter->pos->tag == 0)
     {
         /* Wrapped back to beginning, reinitialize */
-        (void)pb_field_iter_begin(iter, iter->start, iter->dest_struct);
+        pb_field_iter_rewind(iter);
         return false;
     }
-    else
+    
+    if (PB_HTYPE(prev_field->type) == PB_HTYPE_REQUIRED)
     {
-        /* Increment the pointers based on previous field size */
-        size_t prev_size = prev_field->data_size;
+        /* Count the required fields, in order to check their presence in the
+         * decoder. */
+        iter->required_field_index++;
+    }
     
-        if (PB_HTYPE(prev_field->type) == PB_HTYPE_ONEOF &&
-            PB_HTYPE(iter->pos->type) == PB_HTYPE_ONEOF)
-        {
-            /* Don't advance pointers inside unions */
-            prev_size = 0;
-            iter->pData = (char*)iter->pData - prev_field->data_offset;
-        }
-        else if (PB_ATYPE(prev_field->type) == PB_ATYPE_STATIC &&
-                 PB_HTYPE(prev_field->type) == PB_HTYPE_REPEATED)
-        {
-            /* In static arrays, the data_size tells the size of a single entry and
-             * array_size is the number of entries */
-            prev_size *= prev_field->array_size;
-        }
-        else if (PB_ATYPE(prev_field->type) == PB_ATYPE_POINTER)
-        {
-            /* Pointer fields always have a constant size in the main structure.
-             * The data_size only applies to the dynamically allocated area. */
-            prev_size = sizeof(void*);
-        }
+    iter->pData = (char*)iter->dest_struct + iter->pos->data_offset;
+    iter->pSize = (char*)iter->pData + iter->pos->size_offset;
+    return true;
+}
 
-        if (PB_HTYPE(prev_field->type) == PB_HTYPE_REQUIRED)
-        {
-            /* Count the required fields, in order to check their presence in the
-             * decoder. */
-            iter->required_field_index++;
-        }
+/* Find a field using the tag lookup table in iter->info. */
+static bool pb_field_iter_lookup(pb_field_iter_t *iter, uint32_t tag)
+{
+    const pb_msginfo_t *info = iter->info;
+    const pb_field_t *field;
+    uint32_t index;
+    pb_size_t entry;
     
-        iter->pData = (char*)iter->pData + prev_size + iter->pos->data_offset;
-        iter->pSize = (char*)iter->pData + iter->pos->size_offset;
-        return true;
+    if (info->tag_mult == 0)
+    {
+        /* Dense table, indexed by the tag number */
+        if (tag >= info->tag_index_size)
+            return false;
+        index = tag;
     }
+    else
+    {
+        /* Sparse table, indexed by a perfect hash of the tag number */
+        index = (uint32_t)(tag * info->tag_mult) >> info->tag_shift;
+    }
+    
+    entry = info->tag_index[index];
+    if (entry == 0)
+        return false;
+    
+    /* Different tag numbers can map to the same hash table slot,
+     * so check that the tag actually matches. */
+    field = &iter->start[entry - 1];
+    if (field->tag != tag)
+        return false;
+    
+    iter->pos = field;
+    iter->required_field_index = (info->required_index != NULL) ? info->required_index[entry - 1] : 0;
+    iter->pData = (char*)iter->dest_struct + field->data_offset;
+    iter->pSize = (char*)iter->pData + field->size_offset;
+    return true;
 }
 
 bool pb_field_iter_find(pb_field_iter_t *iter, uint32_t tag)
 {
     const pb_field_t *start = iter->pos;
     
+    if (iter->info != NULL && iter->info->tag_index != NULL)
+        return pb_field_iter_lookup(iter, tag);
+    
     do {
         if (iter->pos->tag == tag &&
             PB_LTYPE(iter->pos->type) != PB_LTYPE_EXTENSION)
@@ -13,16 +13,19 @@ extern "C" {
 
 /* Iterator for pb_field_t list */
 struct pb_field_iter_s {
-    const pb_field_t *start;       /* Start of the pb_field_t array */
+    const pb_field_t *start;       /* First field in the pb_field_t array */
     const pb_field_t *pos;         /* Current position of the iterator */
     unsigned required_field_index; /* Zero-based index that counts only the required fields */
     void *dest_struct;             /* Pointer to start of the structure */
     void *pData;                   /* Pointer to current field value */
     void *pSize;                   /* Pointer to count/has field */
+    const pb_msginfo_t *info;      /* Lookup tables for the message, or NULL */
 };
 typedef struct pb_field_iter_s pb_field_iter_t;
 
 /* Initialize the field iterator structure to beginning.
+ * If the field list starts with PB_MSGINFO_FIELD(), the lookup tables
+ * are taken into use for pb_field_iter_find().
  * Returns false if the message type is empty. */
 bool pb_field_iter_begin(pb_field_iter_t *iter, const pb_field_t *fields, void *dest_struct);
 
@@ -31,6 +34,7 @@ bool pb_field_iter_begin(pb_field_iter_t *iter, const pb_field_t *fields, void *
 bool pb_field_iter_next(pb_field_iter_t *iter);
 
 /* Advance the iterator until it points at a field with the given tag.
+ * If the message has a tag lookup table, this jumps directly to the field.
  * Returns false if no such field exists. */
 bool pb_field_iter_find(pb_field_iter_t *iter, uint32_t tag);
 
@@ -23,18 +23,42 @@
 
 typedef bool (*pb_decoder_t)(pb_istream_t *stream, const pb_field_t *field, void *dest) checkreturn;
 
+/* Capacity of the repeated pointer field that was grown most recently while
+ * decoding a message. The entries of a repeated field normally come one
+ * after another, so tracking a single array is enough for geometric growth
+ * without storing the capacity in the message structure. */
+typedef struct {
+    void *pData; /* Address of the array pointer in the message, or NULL */
+    void *pSize; /* Address of the entry count */
+    size_t data_size;
+    size_t capacity;
+} pb_array_growth_t;
+
 static bool checkreturn buf_read(pb_istream_t *stream, uint8_t *buf, size_t count);
 static bool checkreturn pb_decode_varint32(pb_istream_t *stream, uint32_t *dest);
 static bool checkreturn read_raw_value(pb_istream_t *stream, pb_wire_type_t wire_type, uint8_t *buf, size_t *size);
 static bool checkreturn decode_static_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter);
 static bool checkreturn decode_callback_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter);
-static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter);
+static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter, pb_array_growth_t *growth);
 static void iter_from_extension(pb_field_iter_t *iter, pb_extension_t *extension);
 static bool checkreturn default_extension_decoder(pb_istream_t *stream, pb_extension_t *extension, uint32_t tag, pb_wire_type_t wire_type);
+static pb_size_t extension_tag(const pb_extension_t *extension);
+static bool checkreturn index_extension_decoder(pb_istream_t *stream, pb_extension_t *extension, uint32_t tag, pb_wire_type_t wire_type);
+static bool checkreturn index_extension_encoder(pb_ostream_t *stream, const pb_extension_t *extension);
 static bool checkreturn decode_extension(pb_istream_t *stream, uint32_t tag, pb_wire_type_t wire_type, pb_field_iter_t *iter);
 static bool checkreturn find_extension_field(pb_field_iter_t *iter);
 static void pb_field_set_to_default(pb_field_iter_t *iter);
 static void pb_message_set_to_defaults(const pb_field_t fields[], void *dest_struct);
+static void pb_message_set_projected_defaults(const pb_field_t fields[], void *dest_struct, const pb_projection_t *projection);
+static bool checkreturn decode_projected_submessage(pb_istream_t *stream, pb_field_iter_t *iter, const pb_projection_t *projection);
+static pb_wire_type_t field_wire_type(const pb_field_t *field);
+static uint8_t token_size(pb_wire_type_t wire_type);
+static void *push_field_item(pb_field_iter_t *iter);
+static bool checkreturn push_tag(pb_decoder_state_t *state, pb_istream_t *stream);
+static bool checkreturn push_length(pb_decoder_state_t *state, pb_istream_t *stream);
+static bool checkreturn push_token(pb_decoder_state_t *state);
+static bool required_fields_seen(pb_field_iter_t *iter, const uint32_t *fields_seen);
+static bool checkreturn decode_message(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct, const pb_projection_t *projection);
 static bool checkreturn pb_dec_varint(pb_istream_t *stream, const pb_field_t *field, void *dest);
 static bool checkreturn pb_dec_uvarint(pb_istream_t *stream, const pb_field_t *field, void *dest);
 static bool checkreturn pb_dec_svarint(pb_istream_t *stream, const pb_field_t *field, void *dest);
@@ -43,13 +67,20 @@ static bool checkreturn pb_dec_fixed64(pb_istream_t *stream, const pb_field_t *f
 static bool checkreturn pb_dec_bytes(pb_istream_t *stream, const pb_field_t *field, void *dest);
 static bool checkreturn pb_dec_string(pb_istream_t *stream, const pb_field_t *field, void *dest);
 static bool checkreturn pb_dec_submessage(pb_istream_t *stream, const pb_field_t *field, void *dest);
+static bool checkreturn pb_dec_view(pb_istream_t *stream, const pb_field_t *field, void *dest);
 static bool checkreturn pb_skip_varint(pb_istream_t *stream);
 static bool checkreturn pb_skip_string(pb_istream_t *stream);
 
 #ifdef PB_ENABLE_MALLOC
 static bool checkreturn allocate_field(pb_istream_t *stream, void *pData, size_t data_size, size_t array_size);
 static bool checkreturn pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *iter);
-static void pb_release_single_field(const pb_field_iter_t *iter);
+static void pb_release_single_field(const pb_field_iter_t *iter, bool free_memory);
+static void release_fields(const pb_field_t fields[], void *dest_struct, bool free_memory);
+static void release_or_clear_field(pb_istream_t *stream, const pb_field_iter_t *iter);
+static bool checkreturn arena_add_block(pb_arena_t *arena, size_t needed);
+static bool checkreturn grow_pointer_array(pb_istream_t *stream, pb_field_iter_t *iter, pb_array_growth_t *growth);
+static void shrink_pointer_array(pb_istream_t *stream, pb_array_growth_t *growth);
+static void *arena_realloc(pb_arena_t *arena, void *ptr, size_t size);
 #endif
 
 /* --- Function pointers to field decoders ---
@@ -65,23 +96,29 @@ static const pb_decoder_t PB_DECODERS[PB_LTYPES_COUNT] = {
     &pb_dec_bytes,
     &pb_dec_string,
     &pb_dec_submessage,
-    NULL /* extensions */
+    NULL, /* extensions */
+    &pb_dec_view
 };
 
 /*******************************
  * pb_istream_t implementation *
  *******************************/
 
+/* Streams created by pb_istream_from_buffer() can be accessed directly
+ * through the state pointer, avoiding the callback call for each read. */
+#ifdef PB_BUFFER_ONLY
+#define PB_IS_BUFFER_STREAM(stream) true
+#else
+#define PB_IS_BUFFER_STREAM(stream) ((stream)->callback == &buf_read)
+#endif
+
 static bool checkreturn buf_read(pb_istream_t *stream, uint8_t *buf, size_t count)
 {
     uint8_t *source = (uint8_t*)stream->state;
     stream->state = source + count;
     
     if (buf != NULL)
-    {
-        while (count--)
-            *buf++ = *source++;
-    }
+        memcpy(buf, source, count);
     
     return true;
 }
@@ -93,6 +130,19 @@ bool checkreturn pb_read(pb_istream_t *stream, uint8_t *buf, size_t count)
 	{
 		/* Skip input bytes */
 		uint8_t tmp[16];
+		
+		if (stream->skip != NULL)
+		{
+			if (stream->bytes_left < count)
+				PB_RETURN_ERROR(stream, "end-of-stream");
+			
+			if (!stream->skip(stream, count))
+				PB_RETURN_ERROR(stream, "io error");
+			
+			stream->bytes_left -= count;
+			return true;
+		}
+		
 		while (count > 16)
 		{
 			if (!pb_read(stream, tmp, 16))
@@ -109,12 +159,19 @@ bool checkreturn pb_read(pb_istream_t *stream, uint8_t *buf, size_t count)
         PB_RETURN_ERROR(stream, "end-of-stream");
     
 #ifndef PB_BUFFER_ONLY
-    if (!stream->callback(stream, buf, count))
-        PB_RETURN_ERROR(stream, "io error");
-#else
-    if (!buf_read(stream, buf, count))
-        return false;
+    if (!PB_IS_BUFFER_STREAM(stream))
+    {
+        if (!stream->callback(stream, buf, count))
+            PB_RETURN_ERROR(stream, "io error");
+    }
+    else
 #endif
+    {
+        /* The length was already checked, so memory buffers can be
+         * copied directly without the indirect call. */
+        if (!buf_read(stream, buf, count))
+            return false;
+    }
     
     stream->bytes_left -= count;
     return true;
@@ -128,12 +185,17 @@ static bool checkreturn pb_readbyte(pb_istream_t *stream, uint8_t *buf)
         PB_RETURN_ERROR(stream, "end-of-stream");
 
 #ifndef PB_BUFFER_ONLY
-    if (!stream->callback(stream, buf, 1))
-        PB_RETURN_ERROR(stream, "io error");
-#else
-    *buf = *(uint8_t*)stream->state;
-    stream->state = (uint8_t*)stream->state + 1;
+    if (!PB_IS_BUFFER_STREAM(stream))
+    {
+        if (!stream->callback(stream, buf, 1))
+            PB_RETURN_ERROR(stream, "io error");
+    }
+    else
 #endif
+    {
+        *buf = *(const uint8_t*)stream->state;
+        stream->state = (uint8_t*)stream->state + 1;
+    }
 
     stream->bytes_left--;
     
@@ -153,18 +215,229 @@ pb_istream_t pb_istream_from_buffer(uint8_t *buf, size_t bufsize)
 #ifndef PB_NO_ERRMSG
     stream.errmsg = NULL;
 #endif
+    stream.arena = NULL;
+    stream.skip = NULL;
+    return stream;
+}
+
+#ifndef PB_BUFFER_ONLY
+static bool checkreturn readahead_read(pb_istream_t *stream, uint8_t *buf, size_t count)
+{
+    pb_readahead_t *readahead = (pb_readahead_t*)stream->state;
+    
+    while (count > 0)
+    {
+        size_t avail = readahead->end - readahead->pos;
+        
+        if (avail == 0)
+        {
+            /* Refill the buffer, or read large blocks directly to destination. */
+            uint8_t *dest = readahead->buffer;
+            size_t maxlen = readahead->size;
+            size_t len;
+            
+            if (buf != NULL && count >= readahead->size)
+            {
+                dest = buf;
+                maxlen = count;
+            }
+            
+            if (maxlen > readahead->fetch_left)
+                maxlen = readahead->fetch_left;
+            
+            if (maxlen == 0)
+                return false;
+            
+            len = readahead->fill(readahead->source, dest, maxlen);
+            
+            if (len == 0)
+                stream->bytes_left = 0; /* EOF */
+            
+            if (len == 0 || len > maxlen)
+                return false;
+            
+            if (readahead->fetch_left != SIZE_MAX)
+                readahead->fetch_left -= len;
+            
+            if (dest == buf)
+            {
+                buf += len;
+                count -= len;
+                continue;
+            }
+            
+            readahead->pos = 0;
+            readahead->end = len;
+            avail = len;
+        }
+        
+        if (avail > count)
+            avail = count;
+        
+        if (buf != NULL)
+        {
+            memcpy(buf, readahead->buffer + readahead->pos, avail);
+            buf += avail;
+        }
+        
+        readahead->pos += avail;
+        count -= avail;
+    }
+    
+    return true;
+}
+
+/* Skip data by seeking in the source after the buffered part, if
+ * possible. Otherwise it is discarded a buffer at a time, instead of being
+ * copied out in small blocks. */
+static bool checkreturn readahead_skip(pb_istream_t *stream, size_t count)
+{
+    pb_readahead_t *readahead = (pb_readahead_t*)stream->state;
+    size_t avail = readahead->end - readahead->pos;
+    
+    if (readahead->seek != NULL && count > avail)
+    {
+        size_t seek_len = count - avail;
+        readahead->pos = readahead->end;
+        
+        if (seek_len <= readahead->fetch_left &&
+            readahead->seek(readahead->source, seek_len))
+        {
+            if (readahead->fetch_left != SIZE_MAX)
+                readahead->fetch_left -= seek_len;
+            return true;
+        }
+        
+        /* The source is not seekable */
+        readahead->seek = NULL;
+        count = seek_len;
+    }
+    
+    return readahead_read(stream, NULL, count);
+}
+
+void pb_readahead_init(pb_readahead_t *readahead, uint8_t *buf, size_t bufsize,
+                       size_t (*fill)(void *source, uint8_t *buf, size_t count),
+                       void *source)
+{
+    readahead->fill = fill;
+    readahead->source = source;
+    readahead->buffer = buf;
+    readahead->size = bufsize;
+    readahead->pos = 0;
+    readahead->end = 0;
+    readahead->fetch_left = SIZE_MAX;
+    readahead->seek = NULL;
+}
+
+pb_istream_t pb_istream_from_readahead(pb_readahead_t *readahead, size_t bytes_left)
+{
+    pb_istream_t stream;
+    size_t buffered = readahead->end - readahead->pos;
+    
+    /* Limit the reads from source so that they don't go past this message. */
+    if (bytes_left == SIZE_MAX)
+        readahead->fetch_left = SIZE_MAX;
+    else if (bytes_left > buffered)
+        readahead->fetch_left = bytes_left - buffered;
+    else
+        readahead->fetch_left = 0;
+    
+    stream.callback = &readahead_read;
+    stream.state = readahead;
+    stream.bytes_left = bytes_left;
+#ifndef PB_NO_ERRMSG
+    stream.errmsg = NULL;
+#endif
+    stream.arena = NULL;
+    stream.skip = &readahead_skip;
     return stream;
 }
+#endif
 
 /********************
  * Helper functions *
  ********************/
 
+/* Decode up to 4 bytes of a varint from a memory buffer. The bytes are
+ * combined into a single word and the terminating byte is found with bit
+ * masks, instead of testing each byte separately. Stores the data bits to
+ * *value and returns the length of the varint, or 0 if it continues past
+ * the 4 bytes. */
+static uint8_t decode_varint_word(const uint8_t *source, uint32_t *value)
+{
+    uint32_t word, stop, mask;
+    
+    if ((source[0] & 0x80) == 0)
+    {
+        /* Quick case, 1 byte value */
+        *value = source[0];
+        return 1;
+    }
+    
+    word = (uint32_t)source[0] | ((uint32_t)source[1] << 8) |
+           ((uint32_t)source[2] << 16) | ((uint32_t)source[3] << 24);
+    
+    /* Lowest byte that has the continuation bit cleared, and a mask of
+     * the bytes up to and including it. */
+    stop = ~word & 0x80808080U;
+    stop &= 0U - stop;
+    mask = (stop << 1) - 1U;
+    
+    /* Pack the 7-bit groups together */
+    word &= mask & 0x7F7F7F7FU;
+    word = (word & 0x007F007FU) | ((word & 0x7F007F00U) >> 1);
+    word = (word & 0x00003FFFU) | ((word & 0x3FFF0000U) >> 2);
+    *value = word;
+    
+    /* The length is found by branching on the mask, so that the processor
+     * can predict the position of the next varint without waiting for
+     * the arithmetic above. */
+    if (stop == 0)
+        return 0;
+    else if (stop == 0x80U)
+        return 1;
+    else if (stop == 0x8000U)
+        return 2;
+    else if (stop == 0x800000U)
+        return 3;
+    else
+        return 4;
+}
+
 static bool checkreturn pb_decode_varint32(pb_istream_t *stream, uint32_t *dest)
 {
     uint8_t byte;
     uint32_t result;
     
+    if (PB_IS_BUFFER_STREAM(stream) && stream->bytes_left >= 5)
+    {
+        /* Memory buffer with enough data for the longest allowed varint,
+         * so the bytes can be loaded without further bounds checks. */
+        uint8_t *source = (uint8_t*)stream->state;
+        uint8_t count = 0;
+        result = 0;
+        
+        do
+        {
+            if (count >= 5)
+            {
+                stream->state = source + count;
+                stream->bytes_left -= count;
+                PB_RETURN_ERROR(stream, "varint overflow");
+            }
+            
+            byte = source[count];
+            result |= (uint32_t)(byte & 0x7F) << (7 * count);
+            count++;
+        } while (byte & 0x80);
+        
+        stream->state = source + count;
+        stream->bytes_left -= count;
+        *dest = result;
+        return true;
+    }
+    
     if (!pb_readbyte(stream, &byte))
         return false;
     
@@ -202,6 +475,60 @@ bool checkreturn pb_decode_varint(pb_istream_t *stream, uint64_t *dest)
     uint8_t bitpos = 0;
     uint64_t result = 0;
     
+    if (PB_IS_BUFFER_STREAM(stream) && stream->bytes_left >= 10)
+    {
+        /* Memory buffer with enough data for the longest allowed varint,
+         * so the bytes can be loaded without further bounds checks. */
+        uint8_t *source = (uint8_t*)stream->state;
+        uint8_t count = 0;
+        
+        do
+        {
+            byte = source[count];
+            result |= (uint64_t)(byte & 0x7F) << (7 * count);
+            count++;
+        } while ((byte & 0x80) && count < 4);
+        
+        if (byte & 0x80)
+        {
+            /* Long varint, e.g. a negative number. Decode the next four
+             * bytes at once and the last two separately. */
+            uint32_t part;
+            count = decode_varint_word(source + 4, &part);
+            result |= (uint64_t)part << 28;
+            
+            if (count != 0)
+            {
+                count = (uint8_t)(count + 4);
+            }
+            else
+            {
+                byte = source[8];
+                result |= (uint64_t)(byte & 0x7F) << 56;
+                count = 9;
+                
+                if (byte & 0x80)
+                {
+                    byte = source[9];
+                    result |= (uint64_t)(byte & 0x7F) << 63;
+                    count = 10;
+                    
+                    if (byte & 0x80)
+                    {
+                        stream->state = source + count;
+                        stream->bytes_left -= count;
+                        PB_RETURN_ERROR(stream, "varint overflow");
+                    }
+                }
+            }
+        }
+        
+        stream->state = source + count;
+        stream->bytes_left -= count;
+        *dest = result;
+        return true;
+    }
+    
     do
     {
         if (bitpos >= 64)
@@ -223,7 +550,7 @@ bool checkreturn pb_skip_varint(pb_istream_t *stream)
     uint8_t byte;
     do
     {
-        if (!pb_read(stream, &byte, 1))
+        if (!pb_readbyte(stream, &byte))
             return false;
     } while (byte & 0x80);
     return true;
@@ -337,6 +664,94 @@ void pb_close_string_substream(pb_istream_t *stream, pb_istream_t *substream)
  * Decode a single field *
  *************************/
 
+/* Decode 8 items of a packed varint array at once, if the next 8 bytes in
+ * the memory buffer are all single byte varints. The values are at most 127,
+ * so they fit in any data_size without range checks. Returns false without
+ * consuming any data if the fast path cannot be used. */
+static bool decode_small_varints(pb_istream_t *stream, const pb_field_t *field, void *dest)
+{
+    const uint8_t *source = (const uint8_t*)stream->state;
+    int32_t values[8];
+    int i;
+    
+    if (!PB_IS_BUFFER_STREAM(stream) || stream->bytes_left < 8)
+        return false;
+    
+    if ((source[0] | source[1] | source[2] | source[3] |
+         source[4] | source[5] | source[6] | source[7]) & 0x80)
+        return false;
+    
+    if (PB_LTYPE(field->type) == PB_LTYPE_SVARINT)
+    {
+        for (i = 0; i < 8; i++)
+            values[i] = (int32_t)(source[i] >> 1) ^ -(int32_t)(source[i] & 1);
+    }
+    else if (field->data_size == 1)
+    {
+        /* Values are stored as is */
+        memcpy(dest, source, 8);
+        stream->state = (uint8_t*)stream->state + 8;
+        stream->bytes_left -= 8;
+        return true;
+    }
+    else
+    {
+        for (i = 0; i < 8; i++)
+            values[i] = source[i];
+    }
+    
+    switch (field->data_size)
+    {
+        case 1: for (i = 0; i < 8; i++) ((int8_t*)dest)[i] = (int8_t)values[i]; break;
+        case 2: for (i = 0; i < 8; i++) ((int16_t*)dest)[i] = (int16_t)values[i]; break;
+        case 4: for (i = 0; i < 8; i++) ((int32_t*)dest)[i] = values[i]; break;
+        case 8: for (i = 0; i < 8; i++) ((int64_t*)dest)[i] = values[i]; break;
+        default: return false;
+    }
+    
+    stream->state = (uint8_t*)stream->state + 8;
+    stream->bytes_left -= 8;
+    return true;
+}
+
+/* Size of one item in a packed fixed32/fixed64 array, if the items can be
+ * read directly into the array, or 0 if they must be decoded one by one. */
+static size_t packed_fixed_size(const pb_field_t *field)
+{
+    if (PB_LTYPE(field->type) == PB_LTYPE_FIXED32 && field->data_size == 4)
+        return 4;
+    else if (PB_LTYPE(field->type) == PB_LTYPE_FIXED64 && field->data_size == 8)
+        return 8;
+    else
+        return 0;
+}
+
+/* Read count fixed-width items of packed array with a single pb_read().
+ * On big endian platforms the byte order is swapped afterwards. */
+static bool checkreturn decode_fixed_array(pb_istream_t *stream, void *dest, size_t item_size, size_t count)
+{
+    if (!pb_read(stream, (uint8_t*)dest, item_size * count))
+        return false;
+    
+#ifdef __BIG_ENDIAN__
+    {
+        uint8_t *item = (uint8_t*)dest;
+        for (; count > 0; count--, item += item_size)
+        {
+            size_t i;
+            for (i = 0; i < item_size / 2; i++)
+            {
+                uint8_t tmp = item[i];
+                item[i] = item[item_size - 1 - i];
+                item[item_size - 1 - i] = tmp;
+            }
+        }
+    }
+#endif
+    
+    return true;
+}
+
 static bool checkreturn decode_static_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter)
 {
     pb_type_t type;
@@ -362,12 +777,38 @@ static bool checkreturn decode_static_field(pb_istream_t *stream, pb_wire_type_t
                 bool status = true;
                 pb_size_t *size = (pb_size_t*)iter->pSize;
                 pb_istream_t substream;
+                size_t item_size = packed_fixed_size(iter->pos);
                 if (!pb_make_string_substream(stream, &substream))
                     return false;
                 
-                while (substream.bytes_left > 0 && *size < iter->pos->array_size)
+                if (item_size != 0 && *size < iter->pos->array_size)
+                {
+                    /* Copy all complete items that fit in the array at once.
+                     * Anything left over is handled by the loop below. */
+                    size_t count = substream.bytes_left / item_size;
+                    void *pItem = (uint8_t*)iter->pData + item_size * (*size);
+                    
+                    if (count > (size_t)(iter->pos->array_size - *size))
+                        count = (size_t)(iter->pos->array_size - *size);
+                    
+                    if (!decode_fixed_array(&substream, pItem, item_size, count))
+                        status = false;
+                    else
+                        *size = (pb_size_t)(*size + count);
+                }
+                
+                while (status && substream.bytes_left > 0 && *size < iter->pos->array_size)
                 {
                     void *pItem = (uint8_t*)iter->pData + iter->pos->data_size * (*size);
+                    
+                    if (PB_LTYPE(type) <= PB_LTYPE_SVARINT &&
+                        iter->pos->array_size - *size >= 8 &&
+                        decode_small_varints(&substream, iter->pos, pItem))
+                    {
+                        *size = (pb_size_t)(*size + 8);
+                        continue;
+                    }
+                    
                     if (!func(&substream, iter->pos, pItem))
                     {
                         status = false;
@@ -442,9 +883,18 @@ static bool checkreturn allocate_field(pb_istream_t *stream, void *pData, size_t
     /* Allocate new or expand previous allocation */
     /* Note: on failure the old pointer will remain in the structure,
      * the message must be freed by caller also on error return. */
-    ptr = pb_realloc(ptr, array_size * data_size);
-    if (ptr == NULL)
-        PB_RETURN_ERROR(stream, "realloc failed");
+    if (stream->arena != NULL)
+    {
+        ptr = arena_realloc(stream->arena, ptr, array_size * data_size);
+        if (ptr == NULL)
+            PB_RETURN_ERROR(stream, "arena full");
+    }
+    else
+    {
+        ptr = pb_realloc(ptr, array_size * data_size);
+        if (ptr == NULL)
+            PB_RETURN_ERROR(stream, "realloc failed");
+    }
     
     *(void**)pData = ptr;
     return true;
@@ -463,13 +913,78 @@ static void initialize_pointer_field(void *pItem, pb_field_iter_t *iter)
         pb_message_set_to_defaults((const pb_field_t *) iter->pos->ptr, pItem);
     }
 }
+
+/* Make room for one more entry in a non-packed repeated pointer field.
+ * The space is reserved geometrically, or according to the expected count
+ * given in array_size, so that decoding is linear in the number of entries. */
+static bool checkreturn grow_pointer_array(pb_istream_t *stream, pb_field_iter_t *iter, pb_array_growth_t *growth)
+{
+    size_t count = *(pb_size_t*)iter->pSize;
+    size_t capacity;
+    
+    if (growth == NULL)
+        return allocate_field(stream, iter->pData, iter->pos->data_size, count + 1);
+    
+    if (growth->pData == iter->pData && count < growth->capacity)
+        return true;
+    
+    if (growth->pData != iter->pData)
+        shrink_pointer_array(stream, growth);
+    
+    if (count < iter->pos->array_size)
+        capacity = iter->pos->array_size;
+    else if (count < 4)
+        capacity = 4;
+    else
+        capacity = count * 2;
+    
+    if (capacity > PB_SIZE_MAX)
+        capacity = PB_SIZE_MAX;
+    
+    if (!allocate_field(stream, iter->pData, iter->pos->data_size, capacity))
+        return false;
+    
+    growth->pData = iter->pData;
+    growth->pSize = iter->pSize;
+    growth->data_size = iter->pos->data_size;
+    growth->capacity = capacity;
+    return true;
+}
+
+/* Stop tracking the array, and release the unused capacity unless
+ * PB_NO_SHRINK_ARRAYS is defined. Failure to shrink is not an error. */
+static void shrink_pointer_array(pb_istream_t *stream, pb_array_growth_t *growth)
+{
+#ifndef PB_NO_SHRINK_ARRAYS
+    if (growth->pData != NULL)
+    {
+        size_t count = *(pb_size_t*)growth->pSize;
+        void *ptr = *(void**)growth->pData;
+        
+        if (count > 0 && count < growth->capacity)
+        {
+            if (stream->arena != NULL)
+                ptr = arena_realloc(stream->arena, ptr, count * growth->data_size);
+            else
+                ptr = pb_realloc(ptr, count * growth->data_size);
+            
+            if (ptr != NULL)
+                *(void**)growth->pData = ptr;
+        }
+    }
+#else
+    PB_UNUSED(stream);
+#endif
+    growth->pData = NULL;
+}
 #endif
 
-static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter)
+static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter, pb_array_growth_t *growth)
 {
 #ifndef PB_ENABLE_MALLOC
     PB_UNUSED(wire_type);
     PB_UNUSED(iter);
+    PB_UNUSED(growth);
     PB_RETURN_ERROR(stream, "no malloc support");
 #else
     pb_type_t type;
@@ -487,7 +1002,7 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
                 *(void**)iter->pData != NULL)
             {
                 /* Duplicate field, have to release the old allocation first. */
-                pb_release_single_field(iter);
+                release_or_clear_field(stream, iter);
             }
         
             if (PB_HTYPE(type) == PB_HTYPE_ONEOF)
@@ -517,9 +1032,14 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
                 bool status = true;
                 pb_size_t *size = (pb_size_t*)iter->pSize;
                 size_t allocated_size = *size;
+                size_t item_size = packed_fixed_size(iter->pos);
                 void *pItem;
                 pb_istream_t substream;
                 
+                /* The allocation below does not update the tracked capacity */
+                if (growth != NULL && growth->pData == iter->pData)
+                    growth->pData = NULL;
+                
                 if (!pb_make_string_substream(stream, &substream))
                     return false;
                 
@@ -539,8 +1059,39 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
                         }
                     }
 
-                    /* Decode the array entry */
                     pItem = *(uint8_t**)iter->pData + iter->pos->data_size * (*size);
+                    
+                    if (item_size != 0 && substream.bytes_left >= item_size &&
+                        *size < PB_SIZE_MAX)
+                    {
+                        /* Copy all the allocated fixed-width entries at once */
+                        size_t count = substream.bytes_left / item_size;
+                        
+                        if (count > allocated_size - *size)
+                            count = allocated_size - *size;
+                        
+                        if (count > (size_t)(PB_SIZE_MAX - *size))
+                            count = (size_t)(PB_SIZE_MAX - *size);
+                        
+                        if (!decode_fixed_array(&substream, pItem, item_size, count))
+                        {
+                            status = false;
+                            break;
+                        }
+                        
+                        *size = (pb_size_t)(*size + count);
+                        continue;
+                    }
+                    
+                    if (PB_LTYPE(type) <= PB_LTYPE_SVARINT &&
+                        allocated_size - *size >= 8 && PB_SIZE_MAX - *size >= 8 &&
+                        decode_small_varints(&substream, iter->pos, pItem))
+                    {
+                        *size = (pb_size_t)(*size + 8);
+                        continue;
+                    }
+                    
+                    /* Decode the array entry */
                     initialize_pointer_field(pItem, iter);
                     if (!func(&substream, iter->pos, pItem))
                     {
@@ -572,10 +1123,10 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
                 if (*size == PB_SIZE_MAX)
                     PB_RETURN_ERROR(stream, "too many array entries");
                 
-                (*size)++;
-                if (!allocate_field(stream, iter->pData, iter->pos->data_size, *size))
+                if (!grow_pointer_array(stream, iter, growth))
                     return false;
-            
+                
+                (*size)++;
                 pItem = *(uint8_t**)iter->pData + iter->pos->data_size * (*size - 1);
                 initialize_pointer_field(pItem, iter);
                 return func(stream, iter->pos, pItem);
@@ -634,7 +1185,7 @@ static bool checkreturn decode_callback_field(pb_istream_t *stream, pb_wire_type
     }
 }
 
-static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter)
+static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *iter, pb_array_growth_t *growth)
 {
 #ifdef PB_ENABLE_MALLOC
     /* When decoding an oneof field, check if there is old data that must be
@@ -652,7 +1203,7 @@ static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_t
             return decode_static_field(stream, wire_type, iter);
         
         case PB_ATYPE_POINTER:
-            return decode_pointer_field(stream, wire_type, iter);
+            return decode_pointer_field(stream, wire_type, iter, growth);
         
         case PB_ATYPE_CALLBACK:
             return decode_callback_field(stream, wire_type, iter);
@@ -668,7 +1219,11 @@ static void iter_from_extension(pb_field_iter_t *iter, pb_extension_t *extension
      * It is not actually safe to advance this iterator, but decode_field
      * will not even try to. */
     const pb_field_t *field = (const pb_field_t*)extension->type->arg;
-    (void)pb_field_iter_begin(iter, field, extension->dest);
+    iter->start = field;
+    iter->pos = field;
+    iter->required_field_index = 0;
+    iter->dest_struct = extension->dest;
+    iter->info = NULL;
     iter->pData = extension->dest;
     iter->pSize = &extension->found;
     
@@ -694,29 +1249,86 @@ static bool checkreturn default_extension_decoder(pb_istream_t *stream,
     
     iter_from_extension(&iter, extension);
     extension->found = true;
-    return decode_field(stream, wire_type, &iter);
+    return decode_field(stream, wire_type, &iter, NULL);
 }
 
-/* Try to decode an unknown field as an extension field. Tries each extension
- * decoder in turn, until one of them handles the field or loop ends. */
-static bool checkreturn decode_extension(pb_istream_t *stream,
-    uint32_t tag, pb_wire_type_t wire_type, pb_field_iter_t *iter)
+/* Handler type for pb_extension_index_t.head. The dest pointer of the
+ * head points to the index itself. */
+static const pb_extension_type_t pb_extension_index_type = {
+    &index_extension_decoder,
+    &index_extension_encoder,
+    NULL
+};
+
+static pb_size_t extension_tag(const pb_extension_t *extension)
 {
-    pb_extension_t *extension = *(pb_extension_t* const *)iter->pData;
+    return ((const pb_field_t*)extension->type->arg)->tag;
+}
+
+static bool checkreturn index_extension_decoder(pb_istream_t *stream,
+    pb_extension_t *extension, uint32_t tag, pb_wire_type_t wire_type)
+{
+    const pb_extension_index_t *index = (const pb_extension_index_t*)extension->dest;
     size_t pos = stream->bytes_left;
+    size_t low = 0;
+    size_t high = index->default_count;
+    size_t i;
     
-    while (extension != NULL && pos == stream->bytes_left)
+    /* Find the first extension with this tag */
+    while (low < high)
     {
-        bool status;
-        if (extension->type->decode)
-            status = extension->type->decode(stream, extension, tag, wire_type);
+        size_t mid = low + (high - low) / 2;
+        if (extension_tag(index->entries[mid]) < tag)
+            low = mid + 1;
         else
-            status = default_extension_decoder(stream, extension, tag, wire_type);
-
-        if (!status)
-            return false;
-        
-        extension = extension->next;
+            high = mid;
+    }
+    
+    if (low < index->default_count && extension_tag(index->entries[low]) == tag)
+        return default_extension_decoder(stream, index->entries[low], tag, wire_type);
+    
+    for (i = index->default_count; i < index->count && pos == stream->bytes_left; i++)
+    {
+        pb_extension_t *ext = index->entries[i];
+        if (!ext->type->decode(stream, ext, tag, wire_type))
+            return false;
+    }
+    
+    return true;
+}
+
+/* The extensions after the head are encoded as usual. */
+static bool checkreturn index_extension_encoder(pb_ostream_t *stream,
+    const pb_extension_t *extension)
+{
+    PB_UNUSED(stream);
+    PB_UNUSED(extension);
+    return true;
+}
+
+/* Try to decode an unknown field as an extension field. Tries each extension
+ * decoder in turn, until one of them handles the field or loop ends. */
+static bool checkreturn decode_extension(pb_istream_t *stream,
+    uint32_t tag, pb_wire_type_t wire_type, pb_field_iter_t *iter)
+{
+    pb_extension_t *extension = *(pb_extension_t* const *)iter->pData;
+    size_t pos = stream->bytes_left;
+    
+    while (extension != NULL && pos == stream->bytes_left)
+    {
+        bool status;
+        if (extension->type->decode)
+            status = extension->type->decode(stream, extension, tag, wire_type);
+        else
+            status = default_extension_decoder(stream, extension, tag, wire_type);
+
+        if (!status)
+            return false;
+        
+        if (extension->type == &pb_extension_index_type)
+            break; /* The index covers the rest of the list */
+        
+        extension = extension->next;
     }
     
     return true;
@@ -751,8 +1363,11 @@ static void pb_field_set_to_default(pb_field_iter_t *iter)
         {
             pb_field_iter_t ext_iter;
             ext->found = false;
-            iter_from_extension(&ext_iter, ext);
-            pb_field_set_to_default(&ext_iter);
+            if (ext->type != &pb_extension_index_type)
+            {
+                iter_from_extension(&ext_iter, ext);
+                pb_field_set_to_default(&ext_iter);
+            }
             ext = ext->next;
         }
     }
@@ -818,26 +1433,145 @@ static void pb_message_set_to_defaults(const pb_field_t fields[], void *dest_str
     if (!pb_field_iter_begin(&iter, fields, dest_struct))
         return; /* Empty message type */
     
+    if (iter.info != NULL && iter.info->default_image != NULL)
+    {
+        /* Initialize the whole structure at once */
+        memcpy(dest_struct, iter.info->default_image, iter.info->struct_size);
+        return;
+    }
+    
     do
     {
         pb_field_set_to_default(&iter);
     } while (pb_field_iter_next(&iter));
 }
 
+/* Initialize the fields selected by the projection to default values.
+ * Submessages with their own projection are initialized partially. */
+static void pb_message_set_projected_defaults(const pb_field_t fields[], void *dest_struct, const pb_projection_t *projection)
+{
+    pb_field_iter_t iter;
+
+    if (!pb_field_iter_begin(&iter, fields, dest_struct))
+        return; /* Empty message type */
+    
+    do
+    {
+        size_t index = (size_t)(iter.pos - iter.start);
+        const pb_projection_t *sub = NULL;
+        pb_type_t type = iter.pos->type;
+        
+        if (!PB_PROJECTION_SELECTED(projection->mask, index))
+            continue;
+        
+        if (projection->submsg != NULL)
+            sub = projection->submsg[index];
+        
+        if (sub != NULL && PB_ATYPE(type) == PB_ATYPE_STATIC
+            && PB_LTYPE(type) == PB_LTYPE_SUBMESSAGE
+            && (PB_HTYPE(type) == PB_HTYPE_REQUIRED || PB_HTYPE(type) == PB_HTYPE_OPTIONAL))
+        {
+            if (PB_HTYPE(type) == PB_HTYPE_OPTIONAL)
+                *(bool*)iter.pSize = false;
+            
+            pb_message_set_projected_defaults((const pb_field_t*)iter.pos->ptr, iter.pData, sub);
+        }
+        else
+        {
+            pb_field_set_to_default(&iter);
+        }
+    } while (pb_field_iter_next(&iter));
+}
+
 /*********************
  * Decode all fields *
  *********************/
 
-bool checkreturn pb_decode_noinit(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct)
+/* Check that the bits for all required fields are set in fields_seen.
+ * Moves the iterator. */
+static bool required_fields_seen(pb_field_iter_t *iter, const uint32_t *fields_seen)
+{
+    unsigned req_field_count;
+    uint32_t last_mask;
+    unsigned i;
+    
+    if (iter->info != NULL)
+    {
+        /* The generator has precomputed the number of required fields
+         * and the expected bits in the last word. */
+        req_field_count = iter->info->required_count;
+        last_mask = iter->info->required_mask;
+    }
+    else
+    {
+        /* Figure out the number of required fields by seeking to the
+         * end of the field array. Usually we are already close to end
+         * after decoding.
+         */
+        pb_type_t last_type;
+        do {
+            req_field_count = iter->required_field_index;
+            last_type = iter->pos->type;
+        } while (pb_field_iter_next(iter));
+        
+        /* Fixup if last field was also required. */
+        if (PB_HTYPE(last_type) == PB_HTYPE_REQUIRED && iter->pos->tag != 0)
+            req_field_count++;
+        
+        last_mask = (req_field_count & 31) ? (uint32_t)0xFFFFFFFF >> (32 - (req_field_count & 31)) : 0;
+    }
+    
+    if (req_field_count > PB_MAX_REQUIRED_FIELDS)
+    {
+        /* Only the first PB_MAX_REQUIRED_FIELDS are tracked. */
+        req_field_count = PB_MAX_REQUIRED_FIELDS;
+        last_mask = (req_field_count & 31) ? (uint32_t)0xFFFFFFFF >> (32 - (req_field_count & 31)) : 0;
+    }
+    
+    /* Check the whole words */
+    for (i = 0; i < (req_field_count >> 5); i++)
+    {
+        if (fields_seen[i] != 0xFFFFFFFF)
+            return false;
+    }
+    
+    /* Check the remaining bits */
+    if (last_mask != 0 && fields_seen[req_field_count >> 5] != last_mask)
+        return false;
+    
+    return true;
+}
+
+/* Decode the fields of a message without initializing it first. If the
+ * projection is not NULL, only the fields selected by it are decoded. */
+static bool checkreturn decode_message(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct, const pb_projection_t *projection)
 {
-    uint8_t fields_seen[(PB_MAX_REQUIRED_FIELDS + 7) / 8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    uint32_t fields_seen[(PB_MAX_REQUIRED_FIELDS + 31) / 32] = {0, 0};
     uint32_t extension_range_start = 0;
     pb_field_iter_t iter;
+    pb_array_growth_t growth = {NULL, NULL, 0, 0};
     
     /* Return value ignored, as empty message types will be correctly handled by
      * pb_field_iter_find() anyway. */
     (void)pb_field_iter_begin(&iter, fields, dest_struct);
     
+    if (projection != NULL)
+    {
+        /* Required fields that are not selected count as seen. */
+        pb_field_iter_t req_iter = iter;
+        do
+        {
+            size_t index = (size_t)(req_iter.pos - req_iter.start);
+            if (PB_HTYPE(req_iter.pos->type) == PB_HTYPE_REQUIRED
+                && req_iter.pos->tag != 0
+                && req_iter.required_field_index < PB_MAX_REQUIRED_FIELDS
+                && !PB_PROJECTION_SELECTED(projection->mask, index))
+            {
+                fields_seen[req_iter.required_field_index >> 5] |= (uint32_t)1 << (req_iter.required_field_index & 31);
+            }
+        } while (pb_field_iter_next(&req_iter));
+    }
+    
     while (stream->bytes_left)
     {
         uint32_t tag;
@@ -859,6 +1593,9 @@ bool checkreturn pb_decode_noinit(pb_istream_t *stream, const pb_field_t fields[
             {
                 if (!find_extension_field(&iter))
                     extension_range_start = (uint32_t)-1;
+                else if (projection != NULL && !PB_PROJECTION_SELECTED(
+                            projection->mask, (size_t)(iter.pos - iter.start)))
+                    extension_range_start = (uint32_t)-1;
                 else
                     extension_range_start = iter.pos->tag;
                 
@@ -883,49 +1620,62 @@ bool checkreturn pb_decode_noinit(pb_istream_t *stream, const pb_field_t fields[
             continue;
         }
         
+        if (projection != NULL)
+        {
+            size_t index = (size_t)(iter.pos - iter.start);
+            const pb_projection_t *sub = NULL;
+            
+            if (!PB_PROJECTION_SELECTED(projection->mask, index))
+            {
+                if (!pb_skip_field(stream, wire_type))
+                    return false;
+                continue;
+            }
+            
+            if (projection->submsg != NULL)
+                sub = projection->submsg[index];
+            
+            if (sub != NULL && PB_ATYPE(iter.pos->type) == PB_ATYPE_STATIC
+                && PB_LTYPE(iter.pos->type) == PB_LTYPE_SUBMESSAGE)
+            {
+                if (PB_HTYPE(iter.pos->type) == PB_HTYPE_REQUIRED
+                    && iter.required_field_index < PB_MAX_REQUIRED_FIELDS)
+                {
+                    fields_seen[iter.required_field_index >> 5] |= (uint32_t)1 << (iter.required_field_index & 31);
+                }
+                
+                if (!decode_projected_submessage(stream, &iter, sub))
+                    return false;
+                continue;
+            }
+        }
+        
         if (PB_HTYPE(iter.pos->type) == PB_HTYPE_REQUIRED
             && iter.required_field_index < PB_MAX_REQUIRED_FIELDS)
         {
-            fields_seen[iter.required_field_index >> 3] |= (uint8_t)(1 << (iter.required_field_index & 7));
+            fields_seen[iter.required_field_index >> 5] |= (uint32_t)1 << (iter.required_field_index & 31);
         }
             
-        if (!decode_field(stream, wire_type, &iter))
+        if (!decode_field(stream, wire_type, &iter, &growth))
             return false;
     }
     
+#ifdef PB_ENABLE_MALLOC
+    shrink_pointer_array(stream, &growth);
+#endif
+    
     /* Check that all required fields were present. */
-    {
-        /* First figure out the number of required fields by
-         * seeking to the end of the field array. Usually we
-         * are already close to end after decoding.
-         */
-        unsigned req_field_count;
-        pb_type_t last_type;
-        unsigned i;
-        do {
-            req_field_count = iter.required_field_index;
-            last_type = iter.pos->type;
-        } while (pb_field_iter_next(&iter));
-        
-        /* Fixup if last field was also required. */
-        if (PB_HTYPE(last_type) == PB_HTYPE_REQUIRED && iter.pos->tag != 0)
-            req_field_count++;
-        
-        /* Check the whole bytes */
-        for (i = 0; i < (req_field_count >> 3); i++)
-        {
-            if (fields_seen[i] != 0xFF)
-                PB_RETURN_ERROR(stream, "missing required field");
-        }
-        
-        /* Check the remaining bits */
-        if (fields_seen[req_field_count >> 3] != (0xFF >> (8 - (req_field_count & 7))))
-            PB_RETURN_ERROR(stream, "missing required field");
-    }
+    if (!required_fields_seen(&iter, fields_seen))
+        PB_RETURN_ERROR(stream, "missing required field");
     
     return true;
 }
 
+bool checkreturn pb_decode_noinit(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct)
+{
+    return decode_message(stream, fields, dest_struct, NULL);
+}
+
 bool checkreturn pb_decode(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct)
 {
     bool status;
@@ -933,7 +1683,7 @@ bool checkreturn pb_decode(pb_istream_t *stream, const pb_field_t fields[], void
     status = pb_decode_noinit(stream, fields, dest_struct);
     
 #ifdef PB_ENABLE_MALLOC
-    if (!status)
+    if (!status && stream->arena == NULL)
         pb_release(fields, dest_struct);
 #endif
     
@@ -953,6 +1703,92 @@ bool pb_decode_delimited(pb_istream_t *stream, const pb_field_t fields[], void *
     return status;
 }
 
+/* Decode a static submessage field, restricted to the fields selected by
+ * its projection. */
+static bool checkreturn decode_projected_submessage(pb_istream_t *stream, pb_field_iter_t *iter, const pb_projection_t *projection)
+{
+    const pb_field_t *submsg_fields = (const pb_field_t*)iter->pos->ptr;
+    void *dest = iter->pData;
+    pb_istream_t substream;
+    bool status;
+    
+    if (submsg_fields == NULL)
+        PB_RETURN_ERROR(stream, "invalid field descriptor");
+    
+    switch (PB_HTYPE(iter->pos->type))
+    {
+        case PB_HTYPE_REQUIRED:
+            break;
+        
+        case PB_HTYPE_OPTIONAL:
+            *(bool*)iter->pSize = true;
+            break;
+        
+        case PB_HTYPE_REPEATED:
+        {
+            pb_size_t *size = (pb_size_t*)iter->pSize;
+            if (*size >= iter->pos->array_size)
+                PB_RETURN_ERROR(stream, "array overflow");
+            
+            dest = (uint8_t*)iter->pData + iter->pos->data_size * (*size);
+            (*size)++;
+            pb_message_set_projected_defaults(submsg_fields, dest, projection);
+            break;
+        }
+        
+        case PB_HTYPE_ONEOF:
+#ifdef PB_ENABLE_MALLOC
+            if (!pb_release_union_field(stream, iter))
+                return false;
+#endif
+            *(pb_size_t*)iter->pSize = iter->pos->tag;
+            memset(dest, 0, iter->pos->data_size);
+            pb_message_set_projected_defaults(submsg_fields, dest, projection);
+            break;
+        
+        default:
+            PB_RETURN_ERROR(stream, "invalid field type");
+    }
+    
+    if (!pb_make_string_substream(stream, &substream))
+        return false;
+    
+    status = decode_message(&substream, submsg_fields, dest, projection);
+    pb_close_string_substream(stream, &substream);
+    return status;
+}
+
+bool checkreturn pb_decode_projection(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct, const pb_projection_t *projection)
+{
+    bool status;
+    pb_message_set_projected_defaults(fields, dest_struct, projection);
+    status = decode_message(stream, fields, dest_struct, projection);
+    
+#ifdef PB_ENABLE_MALLOC
+    if (!status && stream->arena == NULL)
+        pb_release(fields, dest_struct);
+#endif
+    
+    return status;
+}
+
+bool pb_decode_view(const pb_view_t *view, const pb_field_t fields[], void *dest_struct)
+{
+    pb_istream_t stream;
+    
+    /* The stream only reads from the buffer, so the constness can be
+     * removed without a cast. */
+    union {
+        void *state;
+        const void *c_state;
+    } state;
+    
+    stream = pb_istream_from_buffer(NULL, view->size);
+    state.c_state = view->ptr;
+    stream.state = state.state;
+    return pb_decode(&stream, fields, dest_struct);
+}
+
 #ifdef PB_ENABLE_MALLOC
 /* Given an oneof field, if there has already been a field inside this oneof,
  * release it before overwriting with a different one. */
@@ -972,7 +1808,7 @@ static bool pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *iter)
     if (!pb_field_iter_find(iter, old_tag))
         PB_RETURN_ERROR(stream, "invalid union tag");
 
-    pb_release_single_field(iter);
+    release_or_clear_field(stream, iter);
 
     /* Restore iterator to where it should be.
      * This shouldn't fail unless the pb_field_t structure is corrupted. */
@@ -982,7 +1818,9 @@ static bool pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *iter)
     return true;
 }
 
-static void pb_release_single_field(const pb_field_iter_t *iter)
+/* Release the memory of a field, or with free_memory = false only clear
+ * the pointers to it. */
+static void pb_release_single_field(const pb_field_iter_t *iter, bool free_memory)
 {
     pb_type_t type;
     type = iter->pos->type;
@@ -1003,8 +1841,11 @@ static void pb_release_single_field(const pb_field_iter_t *iter)
         while (ext != NULL)
         {
             pb_field_iter_t ext_iter;
-            iter_from_extension(&ext_iter, ext);
-            pb_release_single_field(&ext_iter);
+            if (ext->type != &pb_extension_index_type)
+            {
+                iter_from_extension(&ext_iter, ext);
+                pb_release_single_field(&ext_iter, free_memory);
+            }
             ext = ext->next;
         }
     }
@@ -1028,7 +1869,7 @@ static void pb_release_single_field(const pb_field_iter_t *iter)
         {
             while (count--)
             {
-                pb_release((const pb_field_t*)iter->pos->ptr, pItem);
+                release_fields((const pb_field_t*)iter->pos->ptr, pItem, free_memory);
                 pItem = (uint8_t*)pItem + iter->pos->data_size;
             }
         }
@@ -1045,7 +1886,8 @@ static void pb_release_single_field(const pb_field_iter_t *iter)
             pb_size_t count = *(pb_size_t*)iter->pSize;
             while (count--)
             {
-                pb_free(*pItem);
+                if (free_memory)
+                    pb_free(*pItem);
                 *pItem++ = NULL;
             }
         }
@@ -1057,12 +1899,13 @@ static void pb_release_single_field(const pb_field_iter_t *iter)
         }
         
         /* Release main item */
-        pb_free(*(void**)iter->pData);
+        if (free_memory)
+            pb_free(*(void**)iter->pData);
         *(void**)iter->pData = NULL;
     }
 }
 
-void pb_release(const pb_field_t fields[], void *dest_struct)
+static void release_fields(const pb_field_t fields[], void *dest_struct, bool free_memory)
 {
     pb_field_iter_t iter;
     
@@ -1071,10 +1914,644 @@ void pb_release(const pb_field_t fields[], void *dest_struct)
     
     do
     {
-        pb_release_single_field(&iter);
+        pb_release_single_field(&iter, free_memory);
     } while (pb_field_iter_next(&iter));
 }
+
+void pb_release(const pb_field_t fields[], void *dest_struct)
+{
+    release_fields(fields, dest_struct, true);
+}
+
+void pb_release_arena(const pb_field_t fields[], void *dest_struct)
+{
+    release_fields(fields, dest_struct, false);
+}
+
+/* Overwriting an old field inside pb_decode(). Memory from an arena is not
+ * released one field at a time, so the pointer is only cleared. */
+static void release_or_clear_field(pb_istream_t *stream, const pb_field_iter_t *iter)
+{
+    if (stream->arena == NULL)
+    {
+        pb_release_single_field(iter, true);
+    }
+    else if (PB_ATYPE(iter->pos->type) == PB_ATYPE_POINTER)
+    {
+        if (PB_HTYPE(iter->pos->type) == PB_HTYPE_REPEATED)
+            *(pb_size_t*)iter->pSize = 0;
+        
+        *(void**)iter->pData = NULL;
+    }
+}
+
+/*******************
+ * Arena allocator *
+ *******************/
+
+/* All arena allocations are aligned suitably for any of these types. */
+typedef union {
+    void *p;
+    uint64_t u;
+    double d;
+    long l;
+} pb_arena_align_t;
+
+#define PB_ARENA_ALIGN(x) (((x) + sizeof(pb_arena_align_t) - 1) & ~(sizeof(pb_arena_align_t) - 1))
+
+/* Each allocation is preceded by its size, so that it can be copied when
+ * it is grown. Overflow blocks start with the pointer to the next block. */
+#define PB_ARENA_HEADER PB_ARENA_ALIGN(sizeof(size_t))
+#define PB_ARENA_BLOCK_HEADER PB_ARENA_ALIGN(sizeof(void*))
+
+void pb_arena_init(pb_arena_t *arena, void *buf, size_t bufsize, size_t block_size)
+{
+    /* Skip the unaligned start of the buffer */
+    size_t skip = PB_ARENA_ALIGN((size_t)buf) - (size_t)buf;
+    if (buf == NULL || bufsize < skip)
+    {
+        buf = NULL;
+        bufsize = 0;
+        skip = 0;
+    }
+    
+    arena->buffer = (uint8_t*)buf + skip;
+    arena->buffer_size = bufsize - skip;
+    arena->block_size = block_size;
+    arena->blocks = NULL;
+    pb_arena_reset(arena);
+}
+
+void pb_arena_reset(pb_arena_t *arena)
+{
+    while (arena->blocks != NULL)
+    {
+        void *next;
+        memcpy(&next, arena->blocks, sizeof(void*));
+        pb_free(arena->blocks);
+        arena->blocks = next;
+    }
+    
+    arena->base = arena->buffer;
+    arena->size = arena->buffer_size;
+    arena->used = 0;
+    arena->last = NULL;
+}
+
+/* Start a new overflow block that has room for at least 'needed' bytes.
+ * The rest of the previous block is left unused. */
+static bool checkreturn arena_add_block(pb_arena_t *arena, size_t needed)
+{
+    uint8_t *block;
+    size_t size = arena->block_size;
+    
+    if (size == 0)
+        return false;
+    
+    if (size < needed)
+        size = needed;
+    
+    if (size > (size_t)-1 - PB_ARENA_BLOCK_HEADER)
+        return false;
+    
+    block = (uint8_t*)pb_realloc(NULL, PB_ARENA_BLOCK_HEADER + size);
+    if (block == NULL)
+        return false;
+    
+    memcpy(block, &arena->blocks, sizeof(void*));
+    arena->blocks = block;
+    arena->base = block + PB_ARENA_BLOCK_HEADER;
+    arena->size = size;
+    arena->used = 0;
+    arena->last = NULL;
+    return true;
+}
+
+/* Same semantics as realloc(), except that memory is taken from the arena.
+ * Growing the latest allocation is done in place when there is room. */
+static void *arena_realloc(pb_arena_t *arena, void *ptr, size_t size)
+{
+    uint8_t *result;
+    size_t old_size = 0;
+    size_t alloc_size;
+    
+    if (size > (size_t)-1 - PB_ARENA_HEADER - sizeof(pb_arena_align_t))
+        return NULL;
+    
+    alloc_size = PB_ARENA_ALIGN(size);
+    
+    if (ptr != NULL)
+    {
+        result = (uint8_t*)ptr;
+        memcpy(&old_size, result - PB_ARENA_HEADER, sizeof(size_t));
+        
+        /* Shrinking is done in place, but only the latest allocation
+         * can give the space back. */
+        if (size <= old_size && result != arena->last)
+            return result;
+        
+        if (result == arena->last &&
+            alloc_size <= arena->size - (size_t)(result - arena->base))
+        {
+            arena->used = (size_t)(result - arena->base) + alloc_size;
+            memcpy(result - PB_ARENA_HEADER, &size, sizeof(size_t));
+            return result;
+        }
+    }
+    
+    if (PB_ARENA_HEADER + alloc_size > arena->size - arena->used)
+    {
+        if (!arena_add_block(arena, PB_ARENA_HEADER + alloc_size))
+            return NULL;
+    }
+    
+    result = arena->base + arena->used + PB_ARENA_HEADER;
+    memcpy(result - PB_ARENA_HEADER, &size, sizeof(size_t));
+    arena->used += PB_ARENA_HEADER + alloc_size;
+    arena->last = result;
+    
+    if (ptr != NULL)
+        memcpy(result, ptr, (old_size < size) ? old_size : size);
+    
+    return result;
+}
+
+bool pb_decode_arena(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct, pb_arena_t *arena)
+{
+    bool status;
+    pb_arena_t *old_arena = stream->arena;
+    
+    stream->arena = arena;
+    status = pb_decode(stream, fields, dest_struct);
+    stream->arena = old_arena;
+    return status;
+}
+#endif
+
+bool pb_extension_index_init(pb_extension_index_t *index, pb_extension_t *extensions,
+                             pb_extension_t **buf, size_t bufsize)
+{
+    pb_extension_t *ext;
+    size_t count = 0;
+
+    /* Insertion sort, keeping the list order for duplicate tags so that
+     * the same extension gets the field as without the index. */
+    for (ext = extensions; ext != NULL; ext = ext->next)
+    {
+        if (ext->type->decode == NULL)
+        {
+            size_t i = count;
+            pb_size_t tag = extension_tag(ext);
+
+            if (count == bufsize)
+                return false;
+
+            while (i > 0 && extension_tag(buf[i - 1]) > tag)
+            {
+                buf[i] = buf[i - 1];
+                i--;
+            }
+            buf[i] = ext;
+            count++;
+        }
+    }
+
+    index->default_count = count;
+
+    for (ext = extensions; ext != NULL; ext = ext->next)
+    {
+        if (ext->type->decode != NULL)
+        {
+            if (count == bufsize)
+                return false;
+
+            buf[count++] = ext;
+        }
+    }
+
+    index->entries = buf;
+    index->count = count;
+    index->head.type = &pb_extension_index_type;
+    index->head.dest = index;
+    index->head.next = extensions;
+    index->head.found = false;
+    return true;
+}
+
+/****************
+ * Push decoder *
+ ****************/
+
+/* Values of pb_decoder_state_t.phase */
+#define PB_PUSH_TAG          0 /* Field tag */
+#define PB_PUSH_VALUE        1 /* Varint or fixed value */
+#define PB_PUSH_LENGTH       2 /* Length of string, submessage or packed array */
+#define PB_PUSH_PACKED       3 /* Item of packed array */
+#define PB_PUSH_COPY         4 /* String data */
+#define PB_PUSH_SKIP_VALUE   5 /* Value of unknown field */
+#define PB_PUSH_SKIP_LENGTH  6 /* Length of unknown field */
+#define PB_PUSH_SKIP         7 /* Data of unknown field */
+#define PB_PUSH_END          8 /* Message was terminated by a zero tag */
+#define PB_PUSH_FAILED       9
+
+/* Wire type that the field is encoded with when not packed */
+static pb_wire_type_t field_wire_type(const pb_field_t *field)
+{
+    switch (PB_LTYPE(field->type))
+    {
+        case PB_LTYPE_VARINT:
+        case PB_LTYPE_UVARINT:
+        case PB_LTYPE_SVARINT:
+            return PB_WT_VARINT;
+        case PB_LTYPE_FIXED32:
+            return PB_WT_32BIT;
+        case PB_LTYPE_FIXED64:
+            return PB_WT_64BIT;
+        default:
+            return PB_WT_STRING;
+    }
+}
+
+static uint8_t token_size(pb_wire_type_t wire_type)
+{
+    if (wire_type == PB_WT_64BIT)
+        return 8;
+    else if (wire_type == PB_WT_32BIT)
+        return 4;
+    else
+        return 0;
+}
+
+/* Update the has_ field, array count or oneof tag like decode_static_field()
+ * does, and return the location for the value. Returns NULL if the array
+ * is full. */
+static void *push_field_item(pb_field_iter_t *iter)
+{
+    switch (PB_HTYPE(iter->pos->type))
+    {
+        case PB_HTYPE_OPTIONAL:
+            *(bool*)iter->pSize = true;
+            return iter->pData;
+        
+        case PB_HTYPE_REPEATED:
+        {
+            pb_size_t *size = (pb_size_t*)iter->pSize;
+            void *pItem = (uint8_t*)iter->pData + iter->pos->data_size * (*size);
+            if (*size >= iter->pos->array_size)
+                return NULL;
+            
+            (*size)++;
+            return pItem;
+        }
+        
+        case PB_HTYPE_ONEOF:
+            *(pb_size_t*)iter->pSize = iter->pos->tag;
+            if (PB_LTYPE(iter->pos->type) == PB_LTYPE_SUBMESSAGE)
+            {
+                memset(iter->pData, 0, iter->pos->data_size);
+                pb_message_set_to_defaults((const pb_field_t*)iter->pos->ptr, iter->pData);
+            }
+            return iter->pData;
+        
+        default:
+            return iter->pData;
+    }
+}
+
+/* Handle a complete tag and find out how to receive the field value. */
+static bool checkreturn push_tag(pb_decoder_state_t *state, pb_istream_t *stream)
+{
+    pb_decoder_level_t *level = &state->stack[state->depth];
+    const pb_field_t *field;
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof;
+    
+    if (!pb_decode_tag(stream, &wire_type, &tag, &eof))
+    {
+        if (!eof)
+            return false;
+        
+        /* Zero tag ends the message, like in pb_decode() */
+        if (state->depth == 0)
+        {
+            state->phase = PB_PUSH_END;
+        }
+        else if (state->pos == level->end)
+        {
+            /* Nothing left to skip, the submessage ends here */
+            state->phase = PB_PUSH_TAG;
+        }
+        else
+        {
+            state->phase = PB_PUSH_SKIP;
+            state->data_end = level->end;
+            state->dest = NULL;
+        }
+        return true;
+    }
+    
+    state->wire_type = wire_type;
+    state->token_size = token_size(wire_type);
+    
+    if (!pb_field_iter_find(&level->iter, tag)
+        || PB_LTYPE(level->iter.pos->type) == PB_LTYPE_EXTENSION)
+    {
+        /* Unknown fields and extensions are skipped */
+        if (wire_type == PB_WT_STRING)
+            state->phase = PB_PUSH_SKIP_LENGTH;
+        else if (wire_type == PB_WT_VARINT || wire_type == PB_WT_64BIT || wire_type == PB_WT_32BIT)
+            state->phase = PB_PUSH_SKIP_VALUE;
+        else
+            PB_RETURN_ERROR(stream, "invalid wire_type");
+        return true;
+    }
+    
+    field = level->iter.pos;
+    if (PB_ATYPE(field->type) != PB_ATYPE_STATIC || PB_LTYPE(field->type) == PB_LTYPE_VIEW)
+        PB_RETURN_ERROR(stream, "unsupported field type");
+    
+    if (PB_HTYPE(field->type) == PB_HTYPE_REQUIRED
+        && level->iter.required_field_index < PB_MAX_REQUIRED_FIELDS)
+    {
+        unsigned index = level->iter.required_field_index;
+        level->fields_seen[index >> 5] |= (uint32_t)1 << (index & 31);
+    }
+    
+    if (wire_type == PB_WT_STRING)
+    {
+        if (field_wire_type(field) != PB_WT_STRING && PB_HTYPE(field->type) != PB_HTYPE_REPEATED)
+            PB_RETURN_ERROR(stream, "wrong wire type");
+        state->phase = PB_PUSH_LENGTH;
+    }
+    else
+    {
+        if (field_wire_type(field) != wire_type)
+            PB_RETURN_ERROR(stream, "wrong wire type");
+        state->phase = PB_PUSH_VALUE;
+    }
+    
+    return true;
+}
+
+/* Handle a complete length prefix and prepare for receiving the data. */
+static bool checkreturn push_length(pb_decoder_state_t *state, pb_istream_t *stream)
+{
+    pb_decoder_level_t *level = &state->stack[state->depth];
+    const pb_field_t *field = level->iter.pos;
+    bool skip = (state->phase == PB_PUSH_SKIP_LENGTH);
+    uint32_t size;
+    void *pItem;
+    
+    if (!pb_decode_varint32(stream, &size))
+        return false;
+    
+    if (size > level->end - state->pos)
+        PB_RETURN_ERROR(stream, "parent stream too short");
+    
+    state->data_end = state->pos + size;
+    state->dest = NULL;
+    state->phase = PB_PUSH_TAG;
+    
+    if (skip)
+    {
+        if (size > 0)
+            state->phase = PB_PUSH_SKIP;
+        return true;
+    }
+    
+    if (PB_LTYPE(field->type) <= PB_LTYPE_LAST_PACKABLE)
+    {
+        /* Packed array, each item is received separately */
+        state->wire_type = field_wire_type(field);
+        state->token_size = token_size(state->wire_type);
+        if (size > 0)
+            state->phase = PB_PUSH_PACKED;
+        return true;
+    }
+    
+    if (PB_LTYPE(field->type) == PB_LTYPE_BYTES)
+    {
+        if (size > PB_SIZE_MAX || PB_BYTES_ARRAY_T_ALLOCSIZE(size) > field->data_size)
+            PB_RETURN_ERROR(stream, "bytes overflow");
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_STRING)
+    {
+        if (size >= field->data_size)
+            PB_RETURN_ERROR(stream, "string overflow");
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_SUBMESSAGE)
+    {
+        if (field->ptr == NULL)
+            PB_RETURN_ERROR(stream, "invalid field descriptor");
+        if (state->depth + 1 >= PB_DECODER_MAX_DEPTH)
+            PB_RETURN_ERROR(stream, "max nesting depth exceeded");
+    }
+    
+    pItem = push_field_item(&level->iter);
+    if (pItem == NULL)
+        PB_RETURN_ERROR(stream, "array overflow");
+    
+    if (PB_LTYPE(field->type) == PB_LTYPE_BYTES)
+    {
+        pb_bytes_array_t *bdest = (pb_bytes_array_t*)pItem;
+        bdest->size = (pb_size_t)size;
+        state->dest = bdest->bytes;
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_STRING)
+    {
+        ((uint8_t*)pItem)[size] = 0;
+        state->dest = (uint8_t*)pItem;
+    }
+    else
+    {
+        /* Submessage continues on the next level. New array entries need
+         * to be initialized, others are initialized already. */
+        const pb_field_t *submsg_fields = (const pb_field_t*)field->ptr;
+        pb_decoder_level_t *sublevel = &state->stack[state->depth + 1];
+        
+        if (PB_HTYPE(field->type) == PB_HTYPE_REPEATED)
+            pb_message_set_to_defaults(submsg_fields, pItem);
+        
+        (void)pb_field_iter_begin(&sublevel->iter, submsg_fields, pItem);
+        sublevel->end = state->data_end;
+        memset(sublevel->fields_seen, 0, sizeof(sublevel->fields_seen));
+        state->depth++;
+        state->phase = PB_PUSH_TAG;
+        return true;
+    }
+    
+    if (size > 0)
+        state->phase = PB_PUSH_COPY;
+    return true;
+}
+
+/* Handle a complete tag, length or value in state->token. */
+static bool checkreturn push_token(pb_decoder_state_t *state)
+{
+    pb_istream_t stream = pb_istream_from_buffer(state->token, state->token_len);
+    pb_field_iter_t *iter = &state->stack[state->depth].iter;
+    bool status = true;
+    
+    switch (state->phase)
+    {
+        case PB_PUSH_TAG:
+            status = push_tag(state, &stream);
+            break;
+        
+        case PB_PUSH_LENGTH:
+        case PB_PUSH_SKIP_LENGTH:
+            status = push_length(state, &stream);
+            break;
+        
+        case PB_PUSH_VALUE:
+            status = decode_static_field(&stream, state->wire_type, iter);
+            state->phase = PB_PUSH_TAG;
+            break;
+        
+        case PB_PUSH_PACKED:
+            status = decode_static_field(&stream, state->wire_type, iter);
+            if (state->pos == state->data_end)
+                state->phase = PB_PUSH_TAG;
+            break;
+        
+        default:
+            state->phase = PB_PUSH_TAG;
+            break;
+    }
+    
+    state->token_len = 0;
+    if (!status)
+        PB_RETURN_ERROR(state, PB_GET_ERROR(&stream));
+    
+    return true;
+}
+
+void pb_decoder_init(pb_decoder_state_t *state, const pb_field_t fields[], void *dest_struct)
+{
+    pb_message_set_to_defaults(fields, dest_struct);
+    
+    (void)pb_field_iter_begin(&state->stack[0].iter, fields, dest_struct);
+    state->stack[0].end = SIZE_MAX;
+    memset(state->stack[0].fields_seen, 0, sizeof(state->stack[0].fields_seen));
+    state->depth = 0;
+    state->phase = PB_PUSH_TAG;
+    state->token_len = 0;
+    state->pos = 0;
+    state->data_end = 0;
+    state->dest = NULL;
+#ifndef PB_NO_ERRMSG
+    state->errmsg = NULL;
 #endif
+}
+
+bool pb_decode_feed(pb_decoder_state_t *state, const uint8_t *buf, size_t count)
+{
+    for (;;)
+    {
+        pb_decoder_level_t *level = &state->stack[state->depth];
+        
+        if (state->phase == PB_PUSH_TAG && state->token_len == 0
+            && state->depth > 0 && state->pos == level->end)
+        {
+            /* End of submessage */
+            if (!required_fields_seen(&level->iter, level->fields_seen))
+            {
+                state->phase = PB_PUSH_FAILED;
+                PB_RETURN_ERROR(state, "missing required field");
+            }
+            state->depth--;
+            continue;
+        }
+        
+        if (state->phase == PB_PUSH_FAILED)
+            return false;
+        
+        if (count == 0)
+            return true;
+        
+        if (state->phase == PB_PUSH_COPY || state->phase == PB_PUSH_SKIP)
+        {
+            size_t size = state->data_end - state->pos;
+            if (size > count)
+                size = count;
+            
+            if (state->dest != NULL)
+            {
+                memcpy(state->dest, buf, size);
+                state->dest += size;
+            }
+            
+            buf += size;
+            count -= size;
+            state->pos += size;
+            
+            if (state->pos == state->data_end)
+                state->phase = PB_PUSH_TAG;
+        }
+        else if (state->phase == PB_PUSH_END)
+        {
+            state->pos += count;
+            return true;
+        }
+        else
+        {
+            /* Collect a tag, length or value one byte at a time */
+            size_t end = (state->phase == PB_PUSH_PACKED) ? state->data_end : level->end;
+            uint8_t byte = *buf++;
+            count--;
+            
+            if (state->pos == end)
+            {
+                state->phase = PB_PUSH_FAILED;
+                PB_RETURN_ERROR(state, "end-of-stream");
+            }
+            
+            state->pos++;
+            state->token[state->token_len++] = byte;
+            
+            if (state->phase == PB_PUSH_TAG || state->phase == PB_PUSH_LENGTH ||
+                state->phase == PB_PUSH_SKIP_LENGTH || state->token_size == 0)
+            {
+                if ((byte & 0x80) && state->token_len < sizeof(state->token))
+                    continue;
+            }
+            else if (state->token_len < state->token_size)
+            {
+                continue;
+            }
+            
+            if (!push_token(state))
+            {
+                state->phase = PB_PUSH_FAILED;
+                return false;
+            }
+        }
+    }
+}
+
+bool pb_decode_finish(pb_decoder_state_t *state)
+{
+    pb_decoder_level_t *level = &state->stack[0];
+    
+    if (state->phase == PB_PUSH_FAILED)
+        return false;
+    
+    if (state->phase != PB_PUSH_END &&
+        (state->phase != PB_PUSH_TAG || state->token_len != 0 || state->depth != 0))
+    {
+        state->phase = PB_PUSH_FAILED;
+        PB_RETURN_ERROR(state, "end-of-stream");
+    }
+    
+    if (!required_fields_seen(&level->iter, level->fields_seen))
+    {
+        state->phase = PB_PUSH_FAILED;
+        PB_RETURN_ERROR(state, "missing required field");
+    }
+    
+    return true;
+}
 
 /* Field decoders */
 
@@ -1316,3 +2793,29 @@ static bool checkreturn pb_dec_submessage(pb_istream_t *stream, const pb_field_t
     pb_close_string_substream(stream, &substream);
     return status;
 }
+
+static bool checkreturn pb_dec_view(pb_istream_t *stream, const pb_field_t *field, void *dest)
+{
+    uint32_t size;
+    const uint8_t *ptr;
+    pb_view_t *view = (pb_view_t*)dest;
+    PB_UNUSED(field);
+    
+    if (!pb_decode_varint32(stream, &size))
+        return false;
+    
+    if (size > PB_SIZE_MAX)
+        PB_RETURN_ERROR(stream, "view overflow");
+    
+    /* Only memory buffers have a stable address to point into. */
+    if (!PB_IS_BUFFER_STREAM(stream))
+        PB_RETURN_ERROR(stream, "view requires buffer stream");
+    
+    ptr = (const uint8_t*)stream->state;
+    if (!pb_read(stream, NULL, size))
+        return false;
+    
+    view->ptr = ptr;
+    view->size = (pb_size_t)size;
+    return true;
+}
@@ -7,6 +7,7 @@
 #define PB_DECODE_H_INCLUDED
 
 #include "pb.h"
+#include "pb_common.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,6 +26,8 @@ extern "C" {
  *    is different than from the main stream. Don't use bytes_left to compute
  *    any pointers.
  */
+typedef struct pb_arena_s pb_arena_t;
+
 struct pb_istream_s
 {
 #ifdef PB_BUFFER_ONLY
@@ -43,6 +46,23 @@ struct pb_istream_s
 #ifndef PB_NO_ERRMSG
     const char *errmsg;
 #endif
+
+    /* Arena for pointer fields, set by pb_decode_arena(). Streams created
+     * with an initializer list or pb_istream_from_buffer() have NULL here,
+     * which allocates with pb_realloc(). Present also without
+     * PB_ENABLE_MALLOC, so that the structure layout does not change. */
+    pb_arena_t *arena;
+
+#ifdef PB_BUFFER_ONLY
+    int *skip;
+#else
+    /* Optional function for skipping count bytes of input without reading
+     * them, for example by seeking in a file. It is used for unknown and
+     * ignored fields. pb_read() has already checked count against
+     * bytes_left. If NULL, the skipped data is read through the callback
+     * in small blocks. */
+    bool (*skip)(pb_istream_t *stream, size_t count);
+#endif
 };
 
 /***************************
@@ -85,14 +105,220 @@ bool pb_decode_noinit(pb_istream_t *stream, const pb_field_t fields[], void *des
  */
 bool pb_decode_delimited(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct);
 
+/* Same as pb_decode, except reads the message from the data referenced by
+ * a view. This is used by the generated accessors of submessage fields with
+ * the lazy option, e.g. MyMessage_header_decode(&msg, &header).
+ */
+bool pb_decode_view(const pb_view_t *view, const pb_field_t fields[], void *dest_struct);
+
+/* Selection of fields for pb_decode_projection(). Fields are identified by
+ * their index in the fields array, which the generator provides as
+ * MyMessage_myfield_index. The number of fields is MyMessage_fields_count.
+ */
+typedef struct pb_projection_s pb_projection_t;
+struct pb_projection_s
+{
+    /* Bitmask with one bit per field index, set with PB_PROJECTION_SELECT */
+    const uint8_t *mask;
+
+    /* Optional array indexed by field index, or NULL. A non-NULL entry
+     * restricts a selected static submessage field to a subset of its
+     * own fields. */
+    const pb_projection_t * const *submsg;
+};
+
+#define PB_PROJECTION_MASK_SIZE(count) (((count) + 7) / 8)
+#define PB_PROJECTION_SELECT(mask, index) ((mask)[(index) >> 3] |= (uint8_t)(1 << ((index) & 7)))
+#define PB_PROJECTION_SELECTED(mask, index) (((mask)[(index) >> 3] & (1 << ((index) & 7))) != 0)
+
+/* Same as pb_decode, except that only the fields selected by the projection
+ * are decoded. Other fields are skipped in the stream, and are not
+ * initialized either, so their contents in dest_struct are left as is.
+ * Required fields are checked only if they are selected.
+ *
+ * Submessage projections apply to static submessage fields only; other
+ * submessages are decoded completely. If the message has pointer fields,
+ * initialize it before the call (e.g. with MyMessage_init_zero), because
+ * pb_release() looks at all the fields.
+ *
+ * Example usage:
+ *    static uint8_t mask[PB_PROJECTION_MASK_SIZE(MyMessage_fields_count)];
+ *    static const pb_projection_t projection = {mask, NULL};
+ *
+ *    PB_PROJECTION_SELECT(mask, MyMessage_id_index);
+ *    pb_decode_projection(&stream, MyMessage_fields, &msg, &projection);
+ */
+bool pb_decode_projection(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct, const pb_projection_t *projection);
+
 #ifdef PB_ENABLE_MALLOC
 /* Release any allocated pointer fields. If you use dynamic allocation, you should
  * call this for any successfully decoded message when you are done with it. If
  * pb_decode() returns with an error, the message is already released.
  */
 void pb_release(const pb_field_t fields[], void *dest_struct);
+
+/* Region allocator for pointer fields. Allocations are taken sequentially
+ * from the caller's buffer, and are all released at once by resetting the
+ * arena. When the buffer runs out, further blocks of at least block_size
+ * bytes are allocated with pb_realloc(), unless block_size is 0.
+ */
+struct pb_arena_s
+{
+    uint8_t *buffer; /* Caller-supplied first block */
+    size_t buffer_size;
+    size_t block_size; /* Minimum size of overflow blocks, 0 to disable */
+    
+    uint8_t *base; /* Block that is currently being allocated from */
+    size_t size; /* Usable size of the current block */
+    size_t used; /* Bytes used in the current block */
+    uint8_t *last; /* Latest allocation, which can be grown in place */
+    void *blocks; /* Linked list of overflow blocks */
+};
+
+/* Initialize an arena. The buffer may be NULL if block_size is nonzero. */
+void pb_arena_init(pb_arena_t *arena, void *buf, size_t bufsize, size_t block_size);
+
+/* Release all messages decoded into the arena, and free the overflow blocks.
+ * The arena can be reused afterwards. */
+void pb_arena_reset(pb_arena_t *arena);
+
+/* Same as pb_decode, except that the pointer fields are allocated from the
+ * arena. The message must not be passed to pb_release(), because its memory
+ * belongs to the arena and stays valid until the arena is reset. This
+ * applies also when decoding fails. Use pb_release_arena() instead if the
+ * message has to be emptied before the reset.
+ *
+ * Example usage:
+ *    uint8_t arena_buffer[1024];
+ *    pb_arena_t arena;
+ *
+ *    pb_arena_init(&arena, arena_buffer, sizeof(arena_buffer), 4096);
+ *    pb_decode_arena(&stream, MyMessage_fields, &msg, &arena);
+ *    // ... use msg ...
+ *    pb_arena_reset(&arena);
+ */
+bool pb_decode_arena(pb_istream_t *stream, const pb_field_t fields[], void *dest_struct, pb_arena_t *arena);
+
+/* Counterpart of pb_release() for messages decoded with pb_decode_arena().
+ * Nothing is freed: the pointer fields are only set to NULL and the array
+ * counts to 0, so that the message no longer refers to the arena. Calling
+ * pb_release() on the message afterwards is harmless.
+ */
+void pb_release_arena(const pb_field_t fields[], void *dest_struct);
+#endif
+
+/* Index of an extension list, for finding the extension field for a tag
+ * with a binary search instead of calling each handler in turn. The index
+ * is itself an extension handler: set message.extensions to &index.head,
+ * which links to the rest of the list. Encoding, pb_release() and setting
+ * the defaults go through the list as usual.
+ */
+typedef struct pb_extension_index_s pb_extension_index_t;
+struct pb_extension_index_s
+{
+    pb_extension_t head;
+
+    /* Extensions with the default handler sorted by tag, followed by the
+     * extensions with a custom decode callback in list order. */
+    pb_extension_t **entries;
+    size_t count;
+    size_t default_count;
+};
+
+/* Build an index of the extension list. The buffer must have room for a
+ * pointer to each extension in the list, otherwise returns false. The index
+ * must be rebuilt if the list is changed.
+ *
+ * Extensions with the default handler are checked first. Extensions with
+ * a custom decode callback get the fields that did not match, in list order.
+ *
+ * Example usage:
+ *    pb_extension_t *entries[16];
+ *    pb_extension_index_t index;
+ *
+ *    pb_extension_index_init(&index, &ext1, entries, 16);
+ *    msg.extensions = &index.head;
+ *    pb_decode(&stream, MyMessage_fields, &msg);
+ */
+bool pb_extension_index_init(pb_extension_index_t *index, pb_extension_t *extensions,
+                             pb_extension_t **buf, size_t bufsize);
+
+
+/****************
+ * Push decoder *
+ ****************/
+
+/* Maximum nesting depth of submessages in the push decoder, including the
+ * top-level message. */
+#ifndef PB_DECODER_MAX_DEPTH
+#define PB_DECODER_MAX_DEPTH 8
+#endif
+
+/* Message or submessage that is being decoded. */
+typedef struct pb_decoder_level_s pb_decoder_level_t;
+struct pb_decoder_level_s
+{
+    pb_field_iter_t iter;
+    size_t end; /* Position where the submessage ends, SIZE_MAX at top */
+    uint32_t fields_seen[(PB_MAX_REQUIRED_FIELDS + 31) / 32];
+};
+
+/* State of a push decoder. Instead of pulling the data from a stream, the
+ * message is fed to the decoder in chunks of any size as it arrives. The
+ * decoder keeps its position, including a partially received varint and
+ * the stack of open submessages, between the calls.
+ *
+ * Only static fields are supported. Decoding fails on callback and pointer
+ * fields, and extension fields are skipped like unknown fields.
+ */
+typedef struct pb_decoder_state_s pb_decoder_state_t;
+struct pb_decoder_state_s
+{
+    pb_decoder_level_t stack[PB_DECODER_MAX_DEPTH];
+    uint8_t depth; /* Index of the innermost level in the stack */
+    
+    uint8_t phase; /* What is being received */
+    pb_wire_type_t wire_type; /* Wire type of the current field */
+    
+    /* Tag, length or value that has been partially received */
+    uint8_t token[10];
+    uint8_t token_len;
+    uint8_t token_size; /* Size of a fixed32/64 value, 0 for a varint */
+    
+    size_t pos; /* Number of bytes received */
+    size_t data_end; /* Position where the string data or packed array ends */
+    uint8_t *dest; /* Destination of string data, NULL when skipping */
+    
+#ifndef PB_NO_ERRMSG
+    const char *errmsg;
 #endif
+};
 
+/* Start decoding a message into dest_struct. The structure is initialized
+ * to default values like in pb_decode(). */
+void pb_decoder_init(pb_decoder_state_t *state, const pb_field_t fields[], void *dest_struct);
+
+/* Decode the next count bytes of the message. The chunk can end at any
+ * byte. Returns false on a decoding error, after which the state cannot be
+ * used anymore. The error message is available with PB_GET_ERROR(state).
+ *
+ * Example usage:
+ *    pb_decoder_state_t state;
+ *
+ *    pb_decoder_init(&state, MyMessage_fields, &msg);
+ *    while ((count = recv(sock, buffer, sizeof(buffer), 0)) > 0)
+ *    {
+ *        if (!pb_decode_feed(&state, buffer, count))
+ *            break;
+ *    }
+ *    status = pb_decode_finish(&state);
+ */
+bool pb_decode_feed(pb_decoder_state_t *state, const uint8_t *buf, size_t count);
+
+/* Finish decoding at the end of the message. Returns false if the message
+ * was truncated, a required field is missing, or an earlier call to
+ * pb_decode_feed() failed. */
+bool pb_decode_finish(pb_decoder_state_t *state);
 
 /**************************************
  * Functions for manipulating streams *
@@ -110,6 +336,55 @@ pb_istream_t pb_istream_from_buffer(uint8_t *buf, size_t bufsize);
  */
 bool pb_read(pb_istream_t *stream, uint8_t *buf, size_t count);
 
+#ifndef PB_BUFFER_ONLY
+/* State of a buffered input stream. The stream reads data from the source
+ * in blocks as large as fits in the buffer, so that e.g. each byte of a
+ * varint does not cause a separate system call.
+ *
+ * The fill function should read at least 1 and at most count bytes from
+ * the source and return the number of bytes read. Unlike the stream
+ * callback, it may return less than requested, for example only the data
+ * that has already arrived to a socket. It should return 0 at end of file
+ * and SIZE_MAX on IO errors.
+ */
+typedef struct pb_readahead_s pb_readahead_t;
+struct pb_readahead_s
+{
+    size_t (*fill)(void *source, uint8_t *buf, size_t count);
+    void *source; /* Free field for use by the fill function */
+    
+    uint8_t *buffer;
+    size_t size; /* Size of the buffer */
+    size_t pos; /* Position of the next unread byte in the buffer */
+    size_t end; /* End of the valid data in the buffer */
+    size_t fetch_left; /* Number of bytes that may still be read from source */
+    
+    /* Optional function for skipping count bytes in the source, used for
+     * skipping large unknown fields. It should return false if it cannot
+     * seek, or if the source ends before count bytes. In that case the
+     * data is read and discarded instead, and seek is not tried again.
+     * Set to NULL by pb_readahead_init(). */
+    bool (*seek)(void *source, size_t count);
+};
+
+/* Initialize the buffered input state. The buffer is supplied by the caller
+ * and must remain valid for as long as the streams are used.
+ */
+void pb_readahead_init(pb_readahead_t *readahead, uint8_t *buf, size_t bufsize,
+                       size_t (*fill)(void *source, uint8_t *buf, size_t count),
+                       void *source);
+
+/* Create an input stream that reads through the buffer. The bytes_left is
+ * the length of the message, or SIZE_MAX if it is not known. Data is never
+ * read from the source past the end of the message.
+ *
+ * Any data that was read ahead but not consumed remains in the buffer, and
+ * will be returned by the next stream created from the same state. This
+ * allows decoding multiple messages from e.g. a socket.
+ */
+pb_istream_t pb_istream_from_readahead(pb_readahead_t *readahead, size_t bytes_left);
+#endif
+
 
 /************************************************
  * Helper functions for writing field callbacks *
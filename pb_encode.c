@@ -22,11 +22,47 @@
  **************************************/
 typedef bool (*pb_encoder_t)(pb_ostream_t *stream, const pb_field_t *field, const void *src) checkreturn;
 
+/* Sizes of submessages and packed arrays for pb_encode_with_size_cache() */
+typedef struct {
+    size_t *sizes;
+    size_t max_count;
+    size_t count;   /* Number of sizes stored by the sizing pass */
+    size_t pos;     /* Next size to use in the writing pass */
+    bool sizing;
+} size_cache_t;
+
 static bool checkreturn buf_write(pb_ostream_t *stream, const uint8_t *buf, size_t count);
 static bool checkreturn encode_array(pb_ostream_t *stream, const pb_field_t *field, const void *pData, size_t count, pb_encoder_t func);
 static bool checkreturn encode_field(pb_ostream_t *stream, const pb_field_t *field, const void *pData);
 static bool checkreturn default_extension_encoder(pb_ostream_t *stream, const pb_extension_t *extension);
 static bool checkreturn encode_extension_field(pb_ostream_t *stream, const pb_field_t *field, const void *pData);
+static bool checkreturn encode_submessage(pb_ostream_t *stream, const pb_field_t fields[], pb_encode_func_t func, const void *src_struct);
+static size_t varint_size(uint64_t value);
+static void write_varint(uint8_t *dest, uint64_t value, size_t size);
+static bool checkreturn varint_value(pb_ostream_t *stream, const pb_field_t *field, const void *src, uint64_t *value);
+static bool checkreturn packed_size(pb_ostream_t *stream, const pb_field_t *field, const void *pData, size_t count, size_t *size);
+static bool checkreturn size_item(pb_ostream_t *stream, const pb_field_t *field, const void *pItem);
+static bool checkreturn size_array(pb_ostream_t *stream, const pb_field_t *field, const void *pData, size_t count);
+static bool checkreturn size_basic_field(pb_ostream_t *stream, const pb_field_t *field, const void *pData);
+static bool checkreturn size_message(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct);
+static void *remove_const(const void *p);
+static bool checkreturn string_data(pb_ostream_t *stream, const pb_field_t *field, const void *src, const uint8_t **data, size_t *size);
+static bool checkreturn encoder_start_field(pb_ostream_t *stream, pb_encoder_level_t *level);
+static bool checkreturn encoder_write_item(pb_encoder_state_t *state, pb_ostream_t *stream);
+static bool checkreturn encoder_next(pb_encoder_state_t *state);
+static bool checkreturn rev_write(pb_ostream_t *stream, const uint8_t *buf, size_t count);
+static bool checkreturn rev_encode_varint(pb_ostream_t *stream, uint64_t value);
+static bool checkreturn rev_encode_scalar(pb_ostream_t *stream, const pb_field_t *field, const void *pItem, bool tag);
+static bool checkreturn rev_encode_item(pb_ostream_t *stream, const pb_field_t *field, const void *pItem);
+static bool checkreturn rev_encode_array(pb_ostream_t *stream, const pb_field_t *field, const void *pData, size_t count);
+static bool checkreturn rev_encode_basic_field(pb_ostream_t *stream, const pb_field_t *field, const void *pData);
+static bool checkreturn rev_encode_forward_field(pb_ostream_t *stream, const pb_field_t *field, const void *pData);
+static bool checkreturn rev_encode_message(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct);
+static bool checkreturn cache_size(pb_ostream_t *stream, size_cache_t *cache, size_t **slot);
+static bool checkreturn cache_encode_item(pb_ostream_t *stream, const pb_field_t *field, const void *pItem, size_cache_t *cache);
+static bool checkreturn cache_encode_array(pb_ostream_t *stream, const pb_field_t *field, const void *pData, size_t count, size_cache_t *cache);
+static bool checkreturn cache_encode_basic_field(pb_ostream_t *stream, const pb_field_t *field, const void *pData, size_cache_t *cache);
+static bool checkreturn cache_encode_message(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct, size_cache_t *cache);
 static bool checkreturn pb_enc_varint(pb_ostream_t *stream, const pb_field_t *field, const void *src);
 static bool checkreturn pb_enc_uvarint(pb_ostream_t *stream, const pb_field_t *field, const void *src);
 static bool checkreturn pb_enc_svarint(pb_ostream_t *stream, const pb_field_t *field, const void *src);
@@ -35,6 +71,7 @@ static bool checkreturn pb_enc_fixed64(pb_ostream_t *stream, const pb_field_t *f
 static bool checkreturn pb_enc_bytes(pb_ostream_t *stream, const pb_field_t *field, const void *src);
 static bool checkreturn pb_enc_string(pb_ostream_t *stream, const pb_field_t *field, const void *src);
 static bool checkreturn pb_enc_submessage(pb_ostream_t *stream, const pb_field_t *field, const void *src);
+static bool checkreturn pb_enc_view(pb_ostream_t *stream, const pb_field_t *field, const void *src);
 
 /* --- Function pointers to field encoders ---
  * Order in the array must match pb_action_t LTYPE numbering.
@@ -49,13 +86,20 @@ static const pb_encoder_t PB_ENCODERS[PB_LTYPES_COUNT] = {
     &pb_enc_bytes,
     &pb_enc_string,
     &pb_enc_submessage,
-    NULL /* extensions */
+    NULL, /* extensions */
+    &pb_enc_view
 };
 
 /*******************************
  * pb_ostream_t implementation *
  *******************************/
 
+#ifdef PB_BUFFER_ONLY
+#define PB_IS_BUFFER_STREAM(stream) ((stream)->callback != NULL)
+#else
+#define PB_IS_BUFFER_STREAM(stream) ((stream)->callback == &buf_write)
+#endif
+
 static bool checkreturn buf_write(pb_ostream_t *stream, const uint8_t *buf, size_t count)
 {
     uint8_t *dest = (uint8_t*)stream->state;
@@ -104,6 +148,77 @@ bool checkreturn pb_write(pb_ostream_t *stream, const uint8_t *buf, size_t count
     return true;
 }
 
+#ifndef PB_BUFFER_ONLY
+static bool checkreturn writebuf_drain(pb_writebuf_t *writebuf)
+{
+    size_t count = writebuf->pos;
+    writebuf->pos = 0;
+    
+    if (count == 0)
+        return true;
+    
+    return writebuf->drain(writebuf->sink, writebuf->buffer, count);
+}
+
+static bool checkreturn writebuf_write(pb_ostream_t *stream, const uint8_t *buf, size_t count)
+{
+    pb_writebuf_t *writebuf = (pb_writebuf_t*)stream->state;
+    
+    if (count > writebuf->size - writebuf->pos)
+    {
+        if (!writebuf_drain(writebuf))
+            return false;
+        
+        /* Large blocks are written directly without copying. */
+        if (count >= writebuf->size)
+            return writebuf->drain(writebuf->sink, buf, count);
+    }
+    
+    memcpy(writebuf->buffer + writebuf->pos, buf, count);
+    writebuf->pos += count;
+    return true;
+}
+
+void pb_writebuf_init(pb_writebuf_t *writebuf, uint8_t *buf, size_t bufsize,
+                      bool (*drain)(void *sink, const uint8_t *buf, size_t count),
+                      void *sink)
+{
+    writebuf->drain = drain;
+    writebuf->sink = sink;
+    writebuf->buffer = buf;
+    writebuf->size = bufsize;
+    writebuf->pos = 0;
+}
+
+pb_ostream_t pb_ostream_from_writebuf(pb_writebuf_t *writebuf, size_t max_size)
+{
+    pb_ostream_t stream;
+    stream.callback = &writebuf_write;
+    stream.state = writebuf;
+    stream.max_size = max_size;
+    stream.bytes_written = 0;
+#ifndef PB_NO_ERRMSG
+    stream.errmsg = NULL;
+#endif
+    return stream;
+}
+#endif
+
+bool checkreturn pb_ostream_flush(pb_ostream_t *stream)
+{
+#ifndef PB_BUFFER_ONLY
+    if (stream->callback == &writebuf_write)
+    {
+        if (!writebuf_drain((pb_writebuf_t*)stream->state))
+            PB_RETURN_ERROR(stream, "io error");
+    }
+#else
+    PB_UNUSED(stream);
+#endif
+    
+    return true;
+}
+
 /*************************
  * Encode a single field *
  *************************/
@@ -129,26 +244,8 @@ static bool checkreturn encode_array(pb_ostream_t *stream, const pb_field_t *fie
             return false;
         
         /* Determine the total size of packed array. */
-        if (PB_LTYPE(field->type) == PB_LTYPE_FIXED32)
-        {
-            size = 4 * count;
-        }
-        else if (PB_LTYPE(field->type) == PB_LTYPE_FIXED64)
-        {
-            size = 8 * count;
-        }
-        else
-        { 
-            pb_ostream_t sizestream = PB_OSTREAM_SIZING;
-            p = pData;
-            for (i = 0; i < count; i++)
-            {
-                if (!func(&sizestream, field, p))
-                    return false;
-                p = (const char*)p + field->data_size;
-            }
-            size = sizestream.bytes_written;
-        }
+        if (!packed_size(stream, field, pData, count, &size))
+            return false;
         
         if (!pb_encode_varint(stream, (uint64_t)size))
             return false;
@@ -352,6 +449,272 @@ static bool checkreturn encode_extension_field(pb_ostream_t *stream,
     return true;
 }
 
+/**************************
+ * Calculate encoded size *
+ *************************/
+
+/* These functions add the size of the data to stream->bytes_written of a
+ * sizing stream, without running the field encoders. */
+
+/* Number of bytes needed to encode value as varint */
+static size_t varint_size(uint64_t value)
+{
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+    /* Each byte holds 7 bits: (bits + 6) / 7 == (bits * 9 + 64) / 64 for
+     * bits <= 64. Zero is encoded with one byte. */
+    size_t bits = 64 - (size_t)__builtin_clzll(value | 1);
+    return (bits * 9 + 64) / 64;
+#else
+    size_t size = 1;
+    while (value >>= 7)
+        size++;
+    return size;
+#endif
+}
+
+/* Load an integer field as the value that pb_enc_varint(), pb_enc_uvarint()
+ * or pb_enc_svarint() would encode. */
+static bool checkreturn varint_value(pb_ostream_t *stream, const pb_field_t *field,
+    const void *src, uint64_t *value)
+{
+    int64_t svalue;
+    
+    if (PB_LTYPE(field->type) == PB_LTYPE_UVARINT)
+    {
+        switch (field->data_size)
+        {
+            case 1: *value = *(const uint8_t*)src; break;
+            case 2: *value = *(const uint16_t*)src; break;
+            case 4: *value = *(const uint32_t*)src; break;
+            case 8: *value = *(const uint64_t*)src; break;
+            default: PB_RETURN_ERROR(stream, "invalid data_size");
+        }
+        return true;
+    }
+    
+    switch (field->data_size)
+    {
+        case 1: svalue = *(const int8_t*)src; break;
+        case 2: svalue = *(const int16_t*)src; break;
+        case 4: svalue = *(const int32_t*)src; break;
+        case 8: svalue = *(const int64_t*)src; break;
+        default: PB_RETURN_ERROR(stream, "invalid data_size");
+    }
+    
+    if (PB_LTYPE(field->type) == PB_LTYPE_SVARINT)
+        *value = (svalue < 0) ? ~((uint64_t)svalue << 1) : (uint64_t)svalue << 1;
+    else
+        *value = (uint64_t)svalue;
+    
+    return true;
+}
+
+/* Size of the contents of a packed array, without the tag and length. */
+static bool checkreturn packed_size(pb_ostream_t *stream, const pb_field_t *field,
+    const void *pData, size_t count, size_t *size)
+{
+    const char *p = (const char*)pData;
+    uint64_t value;
+    size_t i;
+    
+    if (PB_LTYPE(field->type) == PB_LTYPE_FIXED32)
+    {
+        *size = 4 * count;
+        return true;
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_FIXED64)
+    {
+        *size = 8 * count;
+        return true;
+    }
+    
+    *size = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (!varint_value(stream, field, p, &value))
+            return false;
+        *size += varint_size(value);
+        p += field->data_size;
+    }
+    
+    return true;
+}
+
+/* Size of one item of a field, including the tag. */
+static bool checkreturn size_item(pb_ostream_t *stream, const pb_field_t *field, const void *pItem)
+{
+    size_t size;
+    
+    switch (PB_LTYPE(field->type))
+    {
+        case PB_LTYPE_VARINT:
+        case PB_LTYPE_UVARINT:
+        case PB_LTYPE_SVARINT:
+        {
+            uint64_t value;
+            if (!varint_value(stream, field, pItem, &value))
+                return false;
+            size = varint_size(value);
+            break;
+        }
+        
+        case PB_LTYPE_FIXED32:
+            size = 4;
+            break;
+        
+        case PB_LTYPE_FIXED64:
+            size = 8;
+            break;
+        
+        case PB_LTYPE_BYTES:
+        case PB_LTYPE_STRING:
+        case PB_LTYPE_VIEW:
+        {
+            const uint8_t *data;
+            if (!string_data(stream, field, pItem, &data, &size))
+                return false;
+            size += varint_size((uint64_t)size);
+            break;
+        }
+        
+        case PB_LTYPE_SUBMESSAGE:
+        {
+            size_t start = stream->bytes_written;
+            
+            if (field->ptr == NULL)
+                PB_RETURN_ERROR(stream, "invalid field descriptor");
+            
+            /* The contents are added by the recursive call, so only the
+             * length prefix remains. */
+            if (!size_message(stream, (const pb_field_t*)field->ptr, pItem))
+                return false;
+            size = varint_size((uint64_t)(stream->bytes_written - start));
+            break;
+        }
+        
+        default:
+            PB_RETURN_ERROR(stream, "invalid field type");
+    }
+    
+    stream->bytes_written += varint_size((uint64_t)field->tag << 3) + size;
+    return true;
+}
+
+/* Same as encode_array(). */
+static bool checkreturn size_array(pb_ostream_t *stream, const pb_field_t *field,
+    const void *pData, size_t count)
+{
+    const char *p = (const char*)pData;
+    size_t i;
+    
+    if (count == 0)
+        return true;
+    
+    if (PB_ATYPE(field->type) != PB_ATYPE_POINTER && count > field->array_size)
+        PB_RETURN_ERROR(stream, "array max size exceeded");
+    
+    if (PB_LTYPE(field->type) <= PB_LTYPE_LAST_PACKABLE)
+    {
+        size_t size;
+        if (!packed_size(stream, field, pData, count, &size))
+            return false;
+        
+        stream->bytes_written += varint_size((uint64_t)field->tag << 3) +
+                                 varint_size((uint64_t)size) + size;
+        return true;
+    }
+    
+    for (i = 0; i < count; i++)
+    {
+        /* Pointer-type string and bytes arrays contain pointers to the data */
+        if (PB_ATYPE(field->type) == PB_ATYPE_POINTER &&
+            (PB_LTYPE(field->type) == PB_LTYPE_STRING ||
+             PB_LTYPE(field->type) == PB_LTYPE_BYTES))
+        {
+            if (!size_item(stream, field, *(const void* const*)p))
+                return false;
+        }
+        else
+        {
+            if (!size_item(stream, field, p))
+                return false;
+        }
+        p += field->data_size;
+    }
+    
+    return true;
+}
+
+/* Same as encode_basic_field(). */
+static bool checkreturn size_basic_field(pb_ostream_t *stream,
+    const pb_field_t *field, const void *pData)
+{
+    const void *pSize;
+    bool implicit_has = true;
+    
+    if (field->size_offset)
+        pSize = (const char*)pData + field->size_offset;
+    else
+        pSize = &implicit_has;
+    
+    if (PB_ATYPE(field->type) == PB_ATYPE_POINTER)
+    {
+        pData = *(const void* const*)pData;
+        implicit_has = (pData != NULL);
+    }
+    
+    switch (PB_HTYPE(field->type))
+    {
+        case PB_HTYPE_REQUIRED:
+            if (!pData)
+                PB_RETURN_ERROR(stream, "missing required field");
+            return size_item(stream, field, pData);
+        
+        case PB_HTYPE_OPTIONAL:
+            if (*(const bool*)pSize)
+                return size_item(stream, field, pData);
+            return true;
+        
+        case PB_HTYPE_REPEATED:
+            return size_array(stream, field, pData, *(const pb_size_t*)pSize);
+        
+        case PB_HTYPE_ONEOF:
+            if (*(const pb_size_t*)pSize == field->tag)
+                return size_item(stream, field, pData);
+            return true;
+        
+        default:
+            PB_RETURN_ERROR(stream, "invalid field type");
+    }
+}
+
+static bool checkreturn size_message(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct)
+{
+    const pb_field_t *field;
+    
+    for (field = PB_FIRST_FIELD(fields); field->tag != 0; field++)
+    {
+        const void *pData = (const char*)src_struct + field->data_offset;
+        bool status;
+        
+        /* Callback and extension fields are sized by running their encoders */
+        if (PB_LTYPE(field->type) == PB_LTYPE_EXTENSION ||
+            PB_ATYPE(field->type) == PB_ATYPE_CALLBACK)
+        {
+            status = pb_encode_field(stream, field, pData);
+        }
+        else
+        {
+            status = size_basic_field(stream, field, pData);
+        }
+        
+        if (!status)
+            return false;
+    }
+    
+    return true;
+}
+
 /*********************
  * Encode all fields *
  *********************/
@@ -371,6 +734,11 @@ static void *remove_const(const void *p)
 bool checkreturn pb_encode(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct)
 {
     pb_field_iter_t iter;
+    
+    /* Sizing streams only need the length, which is calculated directly */
+    if (stream->callback == NULL)
+        return size_message(stream, fields, src_struct);
+    
     if (!pb_field_iter_begin(&iter, fields, remove_const(src_struct)))
         return true; /* Empty message type */
     
@@ -392,6 +760,14 @@ bool checkreturn pb_encode(pb_ostream_t *stream, const pb_field_t fields[], cons
     return true;
 }
 
+bool checkreturn pb_encode_field(pb_ostream_t *stream, const pb_field_t *field, const void *pData)
+{
+    if (PB_LTYPE(field->type) == PB_LTYPE_EXTENSION)
+        return encode_extension_field(stream, field, pData);
+    else
+        return encode_field(stream, field, pData);
+}
+
 bool pb_encode_delimited(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct)
 {
     return pb_encode_submessage(stream, fields, src_struct);
@@ -408,26 +784,858 @@ bool pb_get_encoded_size(size_t *size, const pb_field_t fields[], const void *sr
     return true;
 }
 
-/********************
- * Helper functions *
- ********************/
-bool checkreturn pb_encode_varint(pb_ostream_t *stream, uint64_t value)
+/*********************
+ * Resumable encoder *
+ *********************/
+
+/* Find the string data of a string, bytes or view field. */
+static bool checkreturn string_data(pb_ostream_t *stream, const pb_field_t *field,
+    const void *src, const uint8_t **data, size_t *size)
 {
-    uint8_t buffer[10];
-    size_t i = 0;
-    
-    if (value == 0)
-        return pb_write(stream, (uint8_t*)&value, 1);
-    
-    while (value)
+    if (src == NULL)
     {
-        buffer[i] = (uint8_t)((value & 0x7F) | 0x80);
-        value >>= 7;
-        i++;
+        /* Null pointer field is encoded as empty */
+        *data = NULL;
+        *size = 0;
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_BYTES)
+    {
+        const pb_bytes_array_t *bytes = (const pb_bytes_array_t*)src;
+        if (PB_ATYPE(field->type) == PB_ATYPE_STATIC &&
+            PB_BYTES_ARRAY_T_ALLOCSIZE(bytes->size) > field->data_size)
+        {
+            PB_RETURN_ERROR(stream, "bytes size exceeded");
+        }
+        
+        *data = bytes->bytes;
+        *size = bytes->size;
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_STRING)
+    {
+        const char *p = (const char*)src;
+        size_t max_size = field->data_size;
+        
+        if (PB_ATYPE(field->type) == PB_ATYPE_POINTER)
+            max_size = (size_t)-1;
+        
+        *size = 0;
+        while (*size < max_size && p[*size] != '\0')
+            (*size)++;
+        
+        *data = (const uint8_t*)src;
+    }
+    else
+    {
+        const pb_view_t *view = (const pb_view_t*)src;
+        if (view->ptr == NULL && view->size != 0)
+            PB_RETURN_ERROR(stream, "invalid view");
+        
+        *data = view->ptr;
+        *size = view->size;
     }
-    buffer[i-1] &= 0x7F; /* Unset top bit on last byte */
     
-    return pb_write(stream, buffer, i);
+    return true;
+}
+
+/* Find out how many items the field at level->iter has, and write the
+ * header of a packed array to stream. */
+static bool checkreturn encoder_start_field(pb_ostream_t *stream, pb_encoder_level_t *level)
+{
+    const pb_field_t *field = level->iter.pos;
+    const void *pSize = level->iter.pSize;
+    
+    level->count = 0;
+    level->index = 0;
+    level->packed = false;
+    
+    if (PB_LTYPE(field->type) == PB_LTYPE_EXTENSION)
+    {
+        if (*(const pb_extension_t* const*)level->iter.pData != NULL)
+            PB_RETURN_ERROR(stream, "unsupported field type");
+        return true;
+    }
+    
+    if (PB_ATYPE(field->type) == PB_ATYPE_CALLBACK)
+    {
+        if (((const pb_callback_t*)level->iter.pData)->funcs.encode != NULL)
+            PB_RETURN_ERROR(stream, "unsupported field type");
+        return true;
+    }
+    
+    if (PB_ATYPE(field->type) == PB_ATYPE_POINTER)
+    {
+        if (*(const void* const*)level->iter.pData != NULL)
+            PB_RETURN_ERROR(stream, "unsupported field type");
+        return true;
+    }
+    
+    switch (PB_HTYPE(field->type))
+    {
+        case PB_HTYPE_REQUIRED:
+            level->count = 1;
+            break;
+        
+        case PB_HTYPE_OPTIONAL:
+            level->count = *(const bool*)pSize ? 1 : 0;
+            break;
+        
+        case PB_HTYPE_ONEOF:
+            level->count = (*(const pb_size_t*)pSize == field->tag) ? 1 : 0;
+            break;
+        
+        case PB_HTYPE_REPEATED:
+            level->count = *(const pb_size_t*)pSize;
+            if (level->count > field->array_size)
+                PB_RETURN_ERROR(stream, "array max size exceeded");
+            
+            /* Arrays are packed the same way as in encode_array() */
+            if (level->count > 0 && PB_LTYPE(field->type) <= PB_LTYPE_LAST_PACKABLE)
+            {
+                pb_encoder_t func = PB_ENCODERS[PB_LTYPE(field->type)];
+                pb_ostream_t sizestream = PB_OSTREAM_SIZING;
+                const uint8_t *p = (const uint8_t*)level->iter.pData;
+                pb_size_t i;
+                
+                for (i = 0; i < level->count; i++)
+                {
+                    if (!func(&sizestream, field, p))
+                        return false;
+                    p += field->data_size;
+                }
+                
+                level->packed = true;
+                return pb_encode_tag(stream, PB_WT_STRING, field->tag) &&
+                       pb_encode_varint(stream, (uint64_t)sizestream.bytes_written);
+            }
+            break;
+        
+        default:
+            PB_RETURN_ERROR(stream, "invalid field type");
+    }
+    
+    return true;
+}
+
+/* Write the next item of the current field to stream. For string fields,
+ * the data is left in state->data. Submessages continue on the next level. */
+static bool checkreturn encoder_write_item(pb_encoder_state_t *state, pb_ostream_t *stream)
+{
+    pb_encoder_level_t *level = &state->stack[state->depth];
+    const pb_field_t *field = level->iter.pos;
+    const void *pItem = (const uint8_t*)level->iter.pData + field->data_size * level->index;
+    pb_encoder_t func = PB_ENCODERS[PB_LTYPE(field->type)];
+    
+    level->index++;
+    
+    if (level->packed)
+        return func(stream, field, pItem);
+    
+    if (!pb_encode_tag_for_field(stream, field))
+        return false;
+    
+    if (PB_LTYPE(field->type) == PB_LTYPE_SUBMESSAGE)
+    {
+        const pb_field_t *submsg_fields = (const pb_field_t*)field->ptr;
+        pb_ostream_t sizestream = PB_OSTREAM_SIZING;
+        pb_encoder_level_t *sublevel;
+        
+        if (submsg_fields == NULL)
+            PB_RETURN_ERROR(stream, "invalid field descriptor");
+        
+        if (!pb_encode(&sizestream, submsg_fields, pItem))
+            PB_RETURN_ERROR(stream, PB_GET_ERROR(&sizestream));
+        
+        if (!pb_encode_varint(stream, (uint64_t)sizestream.bytes_written))
+            return false;
+        
+        if (sizestream.bytes_written == 0)
+            return true;
+        
+        if (state->depth + 1 >= PB_ENCODER_MAX_DEPTH)
+            PB_RETURN_ERROR(stream, "max nesting depth exceeded");
+        
+        sublevel = &state->stack[++state->depth];
+        (void)pb_field_iter_begin(&sublevel->iter, submsg_fields, remove_const(pItem));
+        sublevel->started = false;
+        sublevel->count = 0;
+        sublevel->index = 0;
+        return true;
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_BYTES ||
+             PB_LTYPE(field->type) == PB_LTYPE_STRING ||
+             PB_LTYPE(field->type) == PB_LTYPE_VIEW)
+    {
+        if (!string_data(stream, field, pItem, &state->data, &state->data_left))
+            return false;
+        
+        return pb_encode_varint(stream, (uint64_t)state->data_left);
+    }
+    else
+    {
+        return func(stream, field, pItem);
+    }
+}
+
+/* Prepare the next piece of output in state->pending, or set state->done
+ * at the end of the message. */
+static bool checkreturn encoder_next(pb_encoder_state_t *state)
+{
+    pb_ostream_t stream = pb_ostream_from_buffer(state->pending, sizeof(state->pending));
+    
+    for (;;)
+    {
+        pb_encoder_level_t *level = &state->stack[state->depth];
+        
+        if (level->index < level->count)
+        {
+            if (!encoder_write_item(state, &stream))
+                break;
+            
+            state->pending_pos = 0;
+            state->pending_len = (uint8_t)stream.bytes_written;
+            return true;
+        }
+        
+        /* Go to the next field, or back to the parent message */
+        if (!level->started)
+        {
+            level->started = true;
+        }
+        else if (!pb_field_iter_next(&level->iter))
+        {
+            if (state->depth == 0)
+            {
+                state->done = true;
+                return true;
+            }
+            
+            state->depth--;
+            continue;
+        }
+        
+        if (!encoder_start_field(&stream, level))
+            break;
+        
+        if (stream.bytes_written > 0)
+        {
+            state->pending_pos = 0;
+            state->pending_len = (uint8_t)stream.bytes_written;
+            return true;
+        }
+    }
+    
+    PB_RETURN_ERROR(state, PB_GET_ERROR(&stream));
+}
+
+void pb_encoder_init(pb_encoder_state_t *state, const pb_field_t fields[], const void *src_struct)
+{
+    pb_encoder_level_t *level = &state->stack[0];
+    
+    state->depth = 0;
+    state->pending_pos = 0;
+    state->pending_len = 0;
+    state->data = NULL;
+    state->data_left = 0;
+    state->failed = false;
+#ifndef PB_NO_ERRMSG
+    state->errmsg = NULL;
+#endif
+    
+    /* Empty message type has nothing to write */
+    state->done = !pb_field_iter_begin(&level->iter, fields, remove_const(src_struct));
+    level->started = false;
+    level->count = 0;
+    level->index = 0;
+}
+
+bool pb_encode_fill(pb_encoder_state_t *state, uint8_t *buf, size_t bufsize, size_t *count)
+{
+    size_t written = 0;
+    
+    for (;;)
+    {
+        size_t size = (size_t)(state->pending_len - state->pending_pos);
+        if (size > bufsize - written)
+            size = bufsize - written;
+        
+        memcpy(buf + written, state->pending + state->pending_pos, size);
+        state->pending_pos = (uint8_t)(state->pending_pos + size);
+        written += size;
+        
+        if (state->pending_pos < state->pending_len)
+            break;
+        
+        size = state->data_left;
+        if (size > bufsize - written)
+            size = bufsize - written;
+        
+        if (size > 0)
+        {
+            memcpy(buf + written, state->data, size);
+            state->data += size;
+            state->data_left -= size;
+            written += size;
+        }
+        
+        if (state->data_left > 0 || state->done || state->failed)
+            break;
+        
+        if (!encoder_next(state))
+            state->failed = true;
+    }
+    
+    *count = written;
+    return !state->failed;
+}
+
+/*******************
+ * Reverse encoder *
+ *******************/
+
+/* The reverse encoder uses a pb_ostream_t whose state points to the start
+ * of the data written so far. New data is placed in front of it, and
+ * max_size limits the total amount. */
+
+static bool checkreturn rev_write(pb_ostream_t *stream, const uint8_t *buf, size_t count)
+{
+    if (count > stream->max_size - stream->bytes_written)
+        PB_RETURN_ERROR(stream, "stream full");
+    
+    stream->state = (uint8_t*)stream->state - count;
+    stream->bytes_written += count;
+    if (count > 0)
+        memcpy(stream->state, buf, count);
+    return true;
+}
+
+static bool checkreturn rev_encode_varint(pb_ostream_t *stream, uint64_t value)
+{
+    uint8_t buffer[10];
+    size_t size = varint_size(value);
+    
+    write_varint(buffer, value, size);
+    return rev_write(stream, buffer, size);
+}
+
+/* Encode a value with a forward encoder into a small buffer first. */
+static bool checkreturn rev_encode_scalar(pb_ostream_t *stream, const pb_field_t *field, const void *pItem, bool tag)
+{
+    uint8_t buffer[16];
+    pb_ostream_t substream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    
+    if (tag)
+    {
+        if (!pb_encode_tag_for_field(&substream, field))
+            PB_RETURN_ERROR(stream, PB_GET_ERROR(&substream));
+    }
+    else
+    {
+        if (!PB_ENCODERS[PB_LTYPE(field->type)](&substream, field, pItem))
+            PB_RETURN_ERROR(stream, PB_GET_ERROR(&substream));
+    }
+    
+    return rev_write(stream, buffer, substream.bytes_written);
+}
+
+/* Encode one item of a field, including the tag. */
+static bool checkreturn rev_encode_item(pb_ostream_t *stream, const pb_field_t *field, const void *pItem)
+{
+    if (PB_LTYPE(field->type) == PB_LTYPE_SUBMESSAGE)
+    {
+        size_t end = stream->bytes_written;
+        
+        if (field->ptr == NULL)
+            PB_RETURN_ERROR(stream, "invalid field descriptor");
+        
+        if (!rev_encode_message(stream, (const pb_field_t*)field->ptr, pItem) ||
+            !rev_encode_varint(stream, (uint64_t)(stream->bytes_written - end)))
+            return false;
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_BYTES ||
+             PB_LTYPE(field->type) == PB_LTYPE_STRING ||
+             PB_LTYPE(field->type) == PB_LTYPE_VIEW)
+    {
+        const uint8_t *data;
+        size_t size;
+        
+        if (!string_data(stream, field, pItem, &data, &size) ||
+            !rev_write(stream, data, size) ||
+            !rev_encode_varint(stream, (uint64_t)size))
+            return false;
+    }
+    else
+    {
+        if (!rev_encode_scalar(stream, field, pItem, false))
+            return false;
+    }
+    
+    return rev_encode_scalar(stream, field, NULL, true);
+}
+
+/* Same as encode_array(), but with the items in reverse order. */
+static bool checkreturn rev_encode_array(pb_ostream_t *stream, const pb_field_t *field,
+    const void *pData, size_t count)
+{
+    size_t i = count;
+    
+    if (count == 0)
+        return true;
+    
+    if (PB_ATYPE(field->type) != PB_ATYPE_POINTER && count > field->array_size)
+        PB_RETURN_ERROR(stream, "array max size exceeded");
+    
+    if (PB_LTYPE(field->type) <= PB_LTYPE_LAST_PACKABLE)
+    {
+        size_t end = stream->bytes_written;
+        
+        while (i-- > 0)
+        {
+            const void *p = (const char*)pData + field->data_size * i;
+            if (!rev_encode_scalar(stream, field, p, false))
+                return false;
+        }
+        
+        return rev_encode_varint(stream, (uint64_t)(stream->bytes_written - end)) &&
+               rev_encode_varint(stream, ((uint64_t)field->tag << 3) | PB_WT_STRING);
+    }
+    
+    while (i-- > 0)
+    {
+        const void *p = (const char*)pData + field->data_size * i;
+        
+        /* Pointer-type string and bytes arrays contain pointers to the data */
+        if (PB_ATYPE(field->type) == PB_ATYPE_POINTER &&
+            (PB_LTYPE(field->type) == PB_LTYPE_STRING ||
+             PB_LTYPE(field->type) == PB_LTYPE_BYTES))
+        {
+            p = *(const void* const*)p;
+        }
+        
+        if (!rev_encode_item(stream, field, p))
+            return false;
+    }
+    
+    return true;
+}
+
+/* Same as encode_basic_field(). */
+static bool checkreturn rev_encode_basic_field(pb_ostream_t *stream,
+    const pb_field_t *field, const void *pData)
+{
+    const void *pSize;
+    bool implicit_has = true;
+    
+    if (field->size_offset)
+        pSize = (const char*)pData + field->size_offset;
+    else
+        pSize = &implicit_has;
+    
+    if (PB_ATYPE(field->type) == PB_ATYPE_POINTER)
+    {
+        pData = *(const void* const*)pData;
+        implicit_has = (pData != NULL);
+    }
+    
+    switch (PB_HTYPE(field->type))
+    {
+        case PB_HTYPE_REQUIRED:
+            if (!pData)
+                PB_RETURN_ERROR(stream, "missing required field");
+            return rev_encode_item(stream, field, pData);
+        
+        case PB_HTYPE_OPTIONAL:
+            if (*(const bool*)pSize)
+                return rev_encode_item(stream, field, pData);
+            return true;
+        
+        case PB_HTYPE_REPEATED:
+            return rev_encode_array(stream, field, pData, *(const pb_size_t*)pSize);
+        
+        case PB_HTYPE_ONEOF:
+            if (*(const pb_size_t*)pSize == field->tag)
+                return rev_encode_item(stream, field, pData);
+            return true;
+        
+        default:
+            PB_RETURN_ERROR(stream, "invalid field type");
+    }
+}
+
+/* Callback and extension fields can only be written forwards. They are
+ * encoded twice, first to find the size, then into the space in front of
+ * the data written so far. */
+static bool checkreturn rev_encode_forward_field(pb_ostream_t *stream,
+    const pb_field_t *field, const void *pData)
+{
+    pb_ostream_t substream = PB_OSTREAM_SIZING;
+    size_t size;
+    
+    if (!pb_encode_field(&substream, field, pData))
+        PB_RETURN_ERROR(stream, PB_GET_ERROR(&substream));
+    
+    size = substream.bytes_written;
+    if (size == 0)
+        return true;
+    
+    if (size > stream->max_size - stream->bytes_written)
+        PB_RETURN_ERROR(stream, "stream full");
+    
+    substream = pb_ostream_from_buffer((uint8_t*)stream->state - size, size);
+    if (!pb_encode_field(&substream, field, pData))
+        PB_RETURN_ERROR(stream, PB_GET_ERROR(&substream));
+    
+    if (substream.bytes_written != size)
+        PB_RETURN_ERROR(stream, "callback size changed");
+    
+    stream->state = (uint8_t*)stream->state - size;
+    stream->bytes_written += size;
+    return true;
+}
+
+/* Encode the fields of a message from the last to the first. */
+static bool checkreturn rev_encode_message(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct)
+{
+    const pb_field_t *field;
+    
+    fields = PB_FIRST_FIELD(fields);
+    field = fields;
+    while (field->tag != 0)
+        field++;
+    
+    while (field != fields)
+    {
+        const void *pData;
+        bool status;
+        
+        field--;
+        pData = (const char*)src_struct + field->data_offset;
+        
+        if (PB_LTYPE(field->type) == PB_LTYPE_EXTENSION ||
+            PB_ATYPE(field->type) == PB_ATYPE_CALLBACK)
+        {
+            status = rev_encode_forward_field(stream, field, pData);
+        }
+        else
+        {
+            status = rev_encode_basic_field(stream, field, pData);
+        }
+        
+        if (!status)
+            return false;
+    }
+    
+    return true;
+}
+
+bool checkreturn pb_encode_reverse(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct)
+{
+    pb_ostream_t revstream;
+    uint8_t *start;
+    
+    if (!PB_IS_BUFFER_STREAM(stream))
+        return pb_encode(stream, fields, src_struct);
+    
+    /* Fill the free space of the buffer from the end */
+    start = (uint8_t*)stream->state;
+    revstream = *stream;
+    revstream.max_size = stream->max_size - stream->bytes_written;
+    revstream.bytes_written = 0;
+    revstream.state = start + revstream.max_size;
+    
+    if (!rev_encode_message(&revstream, fields, src_struct))
+    {
+#ifndef PB_NO_ERRMSG
+        stream->errmsg = revstream.errmsg;
+#endif
+        return false;
+    }
+    
+    /* Move the message to the current position of the stream */
+    memmove(start, revstream.state, revstream.bytes_written);
+    stream->state = start + revstream.bytes_written;
+    stream->bytes_written += revstream.bytes_written;
+    return true;
+}
+
+/**********************
+ * Size cache encoder *
+ **********************/
+
+/* Both passes walk the message in the same order. The sizing pass reserves
+ * an entry for each submessage before encoding its contents, so the writing
+ * pass finds the sizes in the order it needs them. */
+
+/* Reserve the next entry in the sizing pass, or take the next stored size
+ * in the writing pass. */
+static bool checkreturn cache_size(pb_ostream_t *stream, size_cache_t *cache, size_t **slot)
+{
+    if (cache->sizing)
+    {
+        if (cache->count >= cache->max_count)
+            PB_RETURN_ERROR(stream, "size cache full");
+        *slot = &cache->sizes[cache->count++];
+    }
+    else
+    {
+        if (cache->pos >= cache->count)
+            PB_RETURN_ERROR(stream, "submsg size changed");
+        *slot = &cache->sizes[cache->pos++];
+    }
+    return true;
+}
+
+/* Encode one item of a field, including the tag. */
+static bool checkreturn cache_encode_item(pb_ostream_t *stream, const pb_field_t *field,
+    const void *pItem, size_cache_t *cache)
+{
+    const pb_field_t *fields = (const pb_field_t*)field->ptr;
+    size_t *size;
+    size_t start;
+
+    if (!pb_encode_tag_for_field(stream, field))
+        return false;
+
+    if (PB_LTYPE(field->type) != PB_LTYPE_SUBMESSAGE)
+        return PB_ENCODERS[PB_LTYPE(field->type)](stream, field, pItem);
+
+    if (fields == NULL)
+        PB_RETURN_ERROR(stream, "invalid field descriptor");
+
+    if (!cache_size(stream, cache, &size))
+        return false;
+
+    if (cache->sizing)
+    {
+        /* The length prefix can be counted after the contents */
+        start = stream->bytes_written;
+        if (!cache_encode_message(stream, fields, pItem, cache))
+            return false;
+
+        *size = stream->bytes_written - start;
+        return pb_encode_varint(stream, (uint64_t)*size);
+    }
+
+    if (!pb_encode_varint(stream, (uint64_t)*size))
+        return false;
+
+    start = stream->bytes_written;
+    if (!cache_encode_message(stream, fields, pItem, cache))
+        return false;
+
+    if (stream->bytes_written - start != *size)
+        PB_RETURN_ERROR(stream, "submsg size changed");
+
+    return true;
+}
+
+/* Same as encode_array(), but packed arrays take their size from the cache. */
+static bool checkreturn cache_encode_array(pb_ostream_t *stream, const pb_field_t *field,
+    const void *pData, size_t count, size_cache_t *cache)
+{
+    pb_encoder_t func = PB_ENCODERS[PB_LTYPE(field->type)];
+    const void *p = pData;
+    size_t i;
+
+    if (count == 0)
+        return true;
+
+    if (PB_ATYPE(field->type) != PB_ATYPE_POINTER && count > field->array_size)
+        PB_RETURN_ERROR(stream, "array max size exceeded");
+
+    if (PB_LTYPE(field->type) <= PB_LTYPE_LAST_PACKABLE)
+    {
+        size_t fixed_size = 0;
+        size_t *size = &fixed_size;
+        size_t start;
+
+        if (!pb_encode_tag(stream, PB_WT_STRING, field->tag))
+            return false;
+
+        /* Only the size of varint arrays needs to be stored */
+        if (PB_LTYPE(field->type) == PB_LTYPE_FIXED32)
+            fixed_size = 4 * count;
+        else if (PB_LTYPE(field->type) == PB_LTYPE_FIXED64)
+            fixed_size = 8 * count;
+        else if (!cache_size(stream, cache, &size))
+            return false;
+
+        if (!cache->sizing || size == &fixed_size)
+        {
+            if (!pb_encode_varint(stream, (uint64_t)*size))
+                return false;
+
+            if (cache->sizing)
+                return pb_write(stream, NULL, *size); /* Just sizing.. */
+        }
+
+        start = stream->bytes_written;
+        for (i = 0; i < count; i++)
+        {
+            if (!func(stream, field, p))
+                return false;
+            p = (const char*)p + field->data_size;
+        }
+
+        if (cache->sizing)
+        {
+            *size = stream->bytes_written - start;
+            return pb_encode_varint(stream, (uint64_t)*size);
+        }
+
+        return true;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        /* Pointer-type string and bytes arrays contain pointers to the data */
+        if (PB_ATYPE(field->type) == PB_ATYPE_POINTER &&
+            (PB_LTYPE(field->type) == PB_LTYPE_STRING ||
+             PB_LTYPE(field->type) == PB_LTYPE_BYTES))
+        {
+            if (!cache_encode_item(stream, field, *(const void* const*)p, cache))
+                return false;
+        }
+        else
+        {
+            if (!cache_encode_item(stream, field, p, cache))
+                return false;
+        }
+        p = (const char*)p + field->data_size;
+    }
+
+    return true;
+}
+
+/* Same as encode_basic_field(). */
+static bool checkreturn cache_encode_basic_field(pb_ostream_t *stream,
+    const pb_field_t *field, const void *pData, size_cache_t *cache)
+{
+    const void *pSize;
+    bool implicit_has = true;
+
+    if (field->size_offset)
+        pSize = (const char*)pData + field->size_offset;
+    else
+        pSize = &implicit_has;
+
+    if (PB_ATYPE(field->type) == PB_ATYPE_POINTER)
+    {
+        pData = *(const void* const*)pData;
+        implicit_has = (pData != NULL);
+    }
+
+    switch (PB_HTYPE(field->type))
+    {
+        case PB_HTYPE_REQUIRED:
+            if (!pData)
+                PB_RETURN_ERROR(stream, "missing required field");
+            return cache_encode_item(stream, field, pData, cache);
+
+        case PB_HTYPE_OPTIONAL:
+            if (*(const bool*)pSize)
+                return cache_encode_item(stream, field, pData, cache);
+            return true;
+
+        case PB_HTYPE_REPEATED:
+            return cache_encode_array(stream, field, pData, *(const pb_size_t*)pSize, cache);
+
+        case PB_HTYPE_ONEOF:
+            if (*(const pb_size_t*)pSize == field->tag)
+                return cache_encode_item(stream, field, pData, cache);
+            return true;
+
+        default:
+            PB_RETURN_ERROR(stream, "invalid field type");
+    }
+}
+
+static bool checkreturn cache_encode_message(pb_ostream_t *stream, const pb_field_t fields[],
+    const void *src_struct, size_cache_t *cache)
+{
+    const pb_field_t *field;
+
+    for (field = PB_FIRST_FIELD(fields); field->tag != 0; field++)
+    {
+        const void *pData = (const char*)src_struct + field->data_offset;
+        bool status;
+
+        /* Callback and extension fields size their own submessages */
+        if (PB_LTYPE(field->type) == PB_LTYPE_EXTENSION ||
+            PB_ATYPE(field->type) == PB_ATYPE_CALLBACK)
+        {
+            status = pb_encode_field(stream, field, pData);
+        }
+        else
+        {
+            status = cache_encode_basic_field(stream, field, pData, cache);
+        }
+
+        if (!status)
+            return false;
+    }
+
+    return true;
+}
+
+bool checkreturn pb_encode_with_size_cache(pb_ostream_t *stream, const pb_field_t fields[],
+    const void *src_struct, size_t *sizes, size_t max_sizes)
+{
+    pb_ostream_t sizestream = PB_OSTREAM_SIZING;
+    size_cache_t cache;
+
+    cache.sizes = sizes;
+    cache.max_count = max_sizes;
+    cache.count = 0;
+    cache.pos = 0;
+    cache.sizing = true;
+
+    if (stream->callback == NULL)
+        return cache_encode_message(stream, fields, src_struct, &cache);
+
+    if (!cache_encode_message(&sizestream, fields, src_struct, &cache))
+    {
+#ifndef PB_NO_ERRMSG
+        stream->errmsg = sizestream.errmsg;
+#endif
+        return false;
+    }
+
+    cache.sizing = false;
+    return cache_encode_message(stream, fields, src_struct, &cache);
+}
+
+/********************
+ * Helper functions *
+ ********************/
+/* Store value as varint. Size must be varint_size(value), so that the
+ * loop does not depend on the bytes already written. */
+static void write_varint(uint8_t *dest, uint64_t value, size_t size)
+{
+    size_t i;
+    for (i = 1; i < size; i++)
+    {
+        *dest++ = (uint8_t)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    *dest = (uint8_t)value;
+}
+
+bool checkreturn pb_encode_varint(pb_ostream_t *stream, uint64_t value)
+{
+    uint8_t buffer[10];
+    size_t size = varint_size(value);
+    
+    if (PB_IS_BUFFER_STREAM(stream) && size <= stream->max_size - stream->bytes_written)
+    {
+        /* There is enough space in the buffer, write directly to it */
+        write_varint((uint8_t*)stream->state, value, size);
+        stream->state = (uint8_t*)stream->state + size;
+        stream->bytes_written += size;
+        return true;
+    }
+    
+    write_varint(buffer, value, size);
+    return pb_write(stream, buffer, size);
 }
 
 bool checkreturn pb_encode_svarint(pb_ostream_t *stream, int64_t value)
@@ -503,6 +1711,7 @@ bool checkreturn pb_encode_tag_for_field(pb_ostream_t *stream, const pb_field_t
         case PB_LTYPE_BYTES:
         case PB_LTYPE_STRING:
         case PB_LTYPE_SUBMESSAGE:
+        case PB_LTYPE_VIEW:
             wiretype = PB_WT_STRING;
             break;
         
@@ -521,14 +1730,22 @@ bool checkreturn pb_encode_string(pb_ostream_t *stream, const uint8_t *buffer, s
     return pb_write(stream, buffer, size);
 }
 
-bool checkreturn pb_encode_submessage(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct)
+/* Encode a submessage with either the field descriptions or an encoding
+ * function. */
+static bool checkreturn encode_submessage(pb_ostream_t *stream,
+    const pb_field_t fields[], pb_encode_func_t func, const void *src_struct)
 {
     /* First calculate the message size using a non-writing substream. */
     pb_ostream_t substream = PB_OSTREAM_SIZING;
     size_t size;
     bool status;
     
-    if (!pb_encode(&substream, fields, src_struct))
+    if (func != NULL)
+        status = func(&substream, src_struct);
+    else
+        status = pb_encode(&substream, fields, src_struct);
+    
+    if (!status)
     {
 #ifndef PB_NO_ERRMSG
         stream->errmsg = substream.errmsg;
@@ -557,7 +1774,10 @@ bool checkreturn pb_encode_submessage(pb_ostream_t *stream, const pb_field_t fie
     substream.errmsg = NULL;
 #endif
     
-    status = pb_encode(&substream, fields, src_struct);
+    if (func != NULL)
+        status = func(&substream, src_struct);
+    else
+        status = pb_encode(&substream, fields, src_struct);
     
     stream->bytes_written += substream.bytes_written;
     stream->state = substream.state;
@@ -571,6 +1791,16 @@ bool checkreturn pb_encode_submessage(pb_ostream_t *stream, const pb_field_t fie
     return status;
 }
 
+bool checkreturn pb_encode_submessage(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct)
+{
+    return encode_submessage(stream, fields, NULL, src_struct);
+}
+
+bool checkreturn pb_encode_submessage_func(pb_ostream_t *stream, pb_encode_func_t func, const void *src_struct)
+{
+    return encode_submessage(stream, NULL, func, src_struct);
+}
+
 /* Field encoders */
 
 static bool checkreturn pb_enc_varint(pb_ostream_t *stream, const pb_field_t *field, const void *src)
@@ -688,3 +1918,13 @@ static bool checkreturn pb_enc_submessage(pb_ostream_t *stream, const pb_field_t
     return pb_encode_submessage(stream, (const pb_field_t*)field->ptr, src);
 }
 
+static bool checkreturn pb_enc_view(pb_ostream_t *stream, const pb_field_t *field, const void *src)
+{
+    const pb_view_t *view = (const pb_view_t*)src;
+    PB_UNUSED(field);
+    
+    if (view->ptr == NULL && view->size != 0)
+        PB_RETURN_ERROR(stream, "invalid view");
+    
+    return pb_encode_string(stream, view->ptr, view->size);
+}
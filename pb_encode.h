@@ -7,6 +7,7 @@
 #define PB_ENCODE_H_INCLUDED
 
 #include "pb.h"
+#include "pb_common.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -71,10 +72,113 @@ bool pb_encode(pb_ostream_t *stream, const pb_field_t fields[], const void *src_
  */
 bool pb_encode_delimited(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct);
 
-/* Encode the message to get the size of the encoded data, but do not store
- * the data. */
+/* Calculate the size of the encoded data, but do not store the data.
+ * The size is calculated from the structure without running the field
+ * encoders, except for callback and extension fields. */
 bool pb_get_encoded_size(size_t *size, const pb_field_t fields[], const void *src_struct);
 
+/* Same as pb_encode, but the fields are written from the end of the free
+ * space in the buffer towards the start, so that the length of each
+ * submessage is known before its length prefix is written. This avoids
+ * encoding submessages twice. Afterwards the message is moved to the
+ * current position of the stream, so the result is the same as with
+ * pb_encode.
+ *
+ * The stream must be a memory buffer from pb_ostream_from_buffer().
+ * Other streams are written with pb_encode. Callback and extension fields
+ * are encoded twice as usual.
+ */
+bool pb_encode_reverse(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct);
+
+/* Encode struct to given output stream, calculating the size of each
+ * submessage only once. A sizing pass first stores the sizes of all
+ * submessages and variable-size packed arrays in the sizes array, in the
+ * order they appear in the output. The writing pass then takes the sizes
+ * from the array instead of encoding each submessage twice.
+ *
+ * Works with any output stream. max_sizes is the number of entries in the
+ * sizes array; if there are more submessages than that, encoding fails
+ * with "size cache full". Callback and extension fields are encoded
+ * twice as usual.
+ */
+bool pb_encode_with_size_cache(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct,
+                               size_t *sizes, size_t max_sizes);
+
+/*********************
+ * Resumable encoder *
+ *********************/
+
+/* Maximum nesting depth of submessages in the resumable encoder, including
+ * the top-level message. */
+#ifndef PB_ENCODER_MAX_DEPTH
+#define PB_ENCODER_MAX_DEPTH 8
+#endif
+
+/* Message or submessage that is being encoded. */
+typedef struct pb_encoder_level_s pb_encoder_level_t;
+struct pb_encoder_level_s
+{
+    pb_field_iter_t iter;
+    bool started; /* False until the first field has been started */
+    bool packed; /* Items of the current field are written as a packed array */
+    pb_size_t count; /* Number of items to write from the current field */
+    pb_size_t index; /* Next item to write */
+};
+
+/* State of a resumable encoder. Instead of writing the whole message to a
+ * stream, the encoder fills a buffer given by the caller and returns. The
+ * next call continues from the same field, array item and byte.
+ *
+ * Only static fields are supported. Encoding fails if the message has
+ * callback or pointer fields that are set, or extensions.
+ */
+typedef struct pb_encoder_state_s pb_encoder_state_t;
+struct pb_encoder_state_s
+{
+    pb_encoder_level_t stack[PB_ENCODER_MAX_DEPTH];
+    uint8_t depth; /* Index of the innermost level in the stack */
+    
+    /* Tag, length or value that has not been written yet */
+    uint8_t pending[16];
+    uint8_t pending_pos;
+    uint8_t pending_len;
+    
+    /* String data that has not been written yet */
+    const uint8_t *data;
+    size_t data_left;
+    
+    bool done; /* Set when the whole message has been written */
+    bool failed;
+    
+#ifndef PB_NO_ERRMSG
+    const char *errmsg;
+#endif
+};
+
+/* Start encoding the message in src_struct. The structure must not change
+ * until the whole message has been written. */
+void pb_encoder_init(pb_encoder_state_t *state, const pb_field_t fields[], const void *src_struct);
+
+/* Write the next part of the message to buf, at most bufsize bytes. The
+ * number of bytes written is stored in count. When state->done is set, the
+ * whole message has been written. Returns false on an encoding error, and
+ * the error message is available with PB_GET_ERROR(state).
+ *
+ * Example usage:
+ *    pb_encoder_state_t state;
+ *    uint8_t buffer[64];
+ *    size_t count;
+ *
+ *    pb_encoder_init(&state, MyMessage_fields, &msg);
+ *    while (!state.done)
+ *    {
+ *        if (!pb_encode_fill(&state, buffer, sizeof(buffer), &count))
+ *            break;
+ *        send(sock, buffer, count, 0);
+ *    }
+ */
+bool pb_encode_fill(pb_encoder_state_t *state, uint8_t *buf, size_t bufsize, size_t *count);
+
 /**************************************
  * Functions for manipulating streams *
  **************************************/
@@ -108,6 +212,43 @@ pb_ostream_t pb_ostream_from_buffer(uint8_t *buf, size_t bufsize);
  */
 bool pb_write(pb_ostream_t *stream, const uint8_t *buf, size_t count);
 
+#ifndef PB_BUFFER_ONLY
+/* State of a buffered output stream. Small writes, such as the tags and
+ * varints, are collected in the buffer and passed to the drain function
+ * only when the buffer is full or when pb_ostream_flush() is called.
+ *
+ * The drain function should write all count bytes to the sink, and return
+ * false on IO errors, in the same way as the stream callback.
+ */
+typedef struct pb_writebuf_s pb_writebuf_t;
+struct pb_writebuf_s
+{
+    bool (*drain)(void *sink, const uint8_t *buf, size_t count);
+    void *sink; /* Free field for use by the drain function */
+    
+    uint8_t *buffer;
+    size_t size; /* Size of the buffer */
+    size_t pos; /* Number of bytes waiting in the buffer */
+};
+
+/* Initialize the buffered output state. The buffer is supplied by the caller
+ * and must remain valid for as long as the streams are used.
+ */
+void pb_writebuf_init(pb_writebuf_t *writebuf, uint8_t *buf, size_t bufsize,
+                      bool (*drain)(void *sink, const uint8_t *buf, size_t count),
+                      void *sink);
+
+/* Create an output stream that writes through the buffer. The data is not
+ * guaranteed to reach the sink until pb_ostream_flush() is called.
+ */
+pb_ostream_t pb_ostream_from_writebuf(pb_writebuf_t *writebuf, size_t max_size);
+#endif
+
+/* Write out any data that the stream has buffered. Does nothing for streams
+ * that are not buffered, so it is always safe to call after encoding.
+ */
+bool pb_ostream_flush(pb_ostream_t *stream);
+
 
 /************************************************
  * Helper functions for writing field callbacks *
@@ -147,6 +288,22 @@ bool pb_encode_fixed64(pb_ostream_t *stream, const void *value);
  */
 bool pb_encode_submessage(pb_ostream_t *stream, const pb_field_t fields[], const void *src_struct);
 
+/* Function that encodes all fields of a message, such as the ones made by
+ * the generate_encoder option. */
+typedef bool (*pb_encode_func_t)(pb_ostream_t *stream, const void *src_struct);
+
+/* Same as pb_encode_submessage, except that the message is encoded by
+ * calling func instead of using the field descriptions.
+ */
+bool pb_encode_submessage_func(pb_ostream_t *stream, pb_encode_func_t func, const void *src_struct);
+
+/* Encode a single field, including its tag, using its pb_field_t entry.
+ * pData points to the field in the message structure. Fields that are not
+ * present in the message are skipped. The generated encoding functions
+ * use this for fields that they do not encode directly.
+ */
+bool pb_encode_field(pb_ostream_t *stream, const pb_field_t *field, const void *pData);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
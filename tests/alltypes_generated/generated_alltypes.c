@@ -0,0 +1,77 @@
+/* Decodes the output of the alltypes test with pb_decode() and with the
+ * generated AllTypes_decode(), then encodes the message again with both
+ * pb_encode() and AllTypes_encode(). All results must be identical.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+int main()
+{
+    int status = 0;
+    uint8_t input[1024];
+    uint8_t output1[1024];
+    uint8_t output2[1024];
+    size_t count;
+    AllTypes table, generated;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(input, 1, sizeof(input), stdin);
+
+    COMMENT("Decoding")
+    {
+        pb_istream_t stream1 = pb_istream_from_buffer(input, count);
+        pb_istream_t stream2 = pb_istream_from_buffer(input, count);
+
+        /* Fill with garbage to detect differences in initialization */
+        memset(&table, 0xAA, sizeof(table));
+        memset(&generated, 0xAA, sizeof(generated));
+
+        TEST(pb_decode(&stream1, AllTypes_fields, &table));
+        TEST(AllTypes_decode(&stream2, &generated));
+        TEST(memcmp(&table, &generated, sizeof(table)) == 0);
+    }
+
+    COMMENT("Encoding")
+    {
+        pb_ostream_t stream1 = pb_ostream_from_buffer(output1, sizeof(output1));
+        pb_ostream_t stream2 = pb_ostream_from_buffer(output2, sizeof(output2));
+        pb_ostream_t sizing = PB_OSTREAM_SIZING;
+
+        TEST(pb_encode(&stream1, AllTypes_fields, &table));
+        TEST(AllTypes_encode(&stream2, &table));
+        TEST(stream1.bytes_written == count && stream2.bytes_written == count);
+        TEST(memcmp(output1, input, count) == 0);
+        TEST(memcmp(output2, input, count) == 0);
+
+        TEST(AllTypes_encode(&sizing, &table));
+        TEST(sizing.bytes_written == count);
+    }
+
+    COMMENT("Delimited encoding")
+    {
+        pb_ostream_t stream1 = pb_ostream_from_buffer(output1, sizeof(output1));
+        pb_ostream_t stream2 = pb_ostream_from_buffer(output2, sizeof(output2));
+
+        TEST(pb_encode_delimited(&stream1, AllTypes_fields, &table));
+        TEST(AllTypes_encode_delimited(&stream2, &table));
+        TEST(stream1.bytes_written == stream2.bytes_written);
+        TEST(memcmp(output1, output2, stream1.bytes_written) == 0);
+    }
+
+    COMMENT("Stream full")
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(output2, count - 1);
+        TEST(!AllTypes_encode(&stream, &table));
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,139 @@
+/* Decodes the AllTypes message from stdin into an arena, checks that the
+ * pointer fields are taken from the arena and that re-encoding gives the
+ * same data.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "malloc_wrappers.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+static uint8_t g_input[1024];
+static size_t g_input_size;
+static uint8_t g_arena_buffer[8192];
+
+/* Encode the message and compare it against the input */
+static bool reencode_matches(const AllTypes *msg)
+{
+    uint8_t buffer[1024];
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    
+    if (!pb_encode(&stream, AllTypes_fields, msg))
+        return false;
+    
+    return stream.bytes_written == g_input_size &&
+           memcmp(buffer, g_input, g_input_size) == 0;
+}
+
+static bool inside_buffer(const void *ptr)
+{
+    const uint8_t *p = (const uint8_t*)ptr;
+    return p >= g_arena_buffer && p < g_arena_buffer + sizeof(g_arena_buffer);
+}
+
+int main()
+{
+    int status = 0;
+    pb_arena_t arena;
+    AllTypes msg;
+    
+    SET_BINARY_MODE(stdin);
+    g_input_size = fread(g_input, 1, sizeof(g_input), stdin);
+    
+    COMMENT("Decode into the caller's buffer")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(g_input, g_input_size);
+        pb_arena_init(&arena, g_arena_buffer, sizeof(g_arena_buffer), 0);
+        memset(&msg, 0xAA, sizeof(msg));
+        msg.extensions = NULL;
+        
+        TEST(pb_decode_arena(&stream, AllTypes_fields, &msg, &arena));
+        TEST(get_alloc_count() == 0);
+        TEST(inside_buffer(msg.req_int32) && *msg.req_int32 == -1001);
+        TEST(inside_buffer(msg.req_string) && strcmp(msg.req_string, "1014") == 0);
+        TEST(inside_buffer(msg.rep_string) && msg.rep_string_count == 5);
+        TEST(inside_buffer(msg.req_submsg) && inside_buffer(msg.req_submsg->substuff1));
+        TEST(msg.end && *msg.end == 1099);
+        TEST(reencode_matches(&msg));
+        
+        /* The stream is left as it was */
+        TEST(stream.arena == NULL);
+        pb_arena_reset(&arena);
+        TEST(arena.used == 0);
+    }
+    
+    COMMENT("Overflow to heap blocks")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(g_input, g_input_size);
+        pb_arena_init(&arena, g_arena_buffer, 64, 128);
+        memset(&msg, 0, sizeof(msg));
+        
+        TEST(pb_decode_arena(&stream, AllTypes_fields, &msg, &arena));
+        TEST(get_alloc_count() > 0);
+        TEST(reencode_matches(&msg));
+        
+        pb_arena_reset(&arena);
+        TEST(get_alloc_count() == 0);
+    }
+    
+    COMMENT("Running out of space without overflow blocks")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(g_input, g_input_size);
+        pb_arena_init(&arena, g_arena_buffer, 64, 0);
+        memset(&msg, 0, sizeof(msg));
+        
+        TEST(!pb_decode_arena(&stream, AllTypes_fields, &msg, &arena));
+        TEST(strcmp(PB_GET_ERROR(&stream), "arena full") == 0);
+        TEST(get_alloc_count() == 0);
+        pb_arena_reset(&arena);
+    }
+    
+    COMMENT("pb_release_arena() clears the message without freeing")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(g_input, g_input_size);
+        size_t used;
+        pb_arena_init(&arena, g_arena_buffer, sizeof(g_arena_buffer), 0);
+        memset(&msg, 0, sizeof(msg));
+
+        TEST(pb_decode_arena(&stream, AllTypes_fields, &msg, &arena));
+        used = arena.used;
+        pb_release_arena(AllTypes_fields, &msg);
+        TEST(msg.req_int32 == NULL && msg.req_string == NULL && msg.req_submsg == NULL);
+        TEST(msg.rep_string == NULL && msg.rep_string_count == 0);
+        TEST(msg.end == NULL);
+        TEST(arena.used == used && get_alloc_count() == 0);
+
+        /* Nothing is left for pb_release() to free */
+        pb_release(AllTypes_fields, &msg);
+        TEST(get_alloc_count() == 0);
+        pb_arena_reset(&arena);
+    }
+
+    COMMENT("Reuse the arena after a reset")
+    {
+        size_t used = 0;
+        int i;
+        
+        pb_arena_init(&arena, g_arena_buffer, sizeof(g_arena_buffer), 0);
+        for (i = 0; i < 3; i++)
+        {
+            pb_istream_t stream = pb_istream_from_buffer(g_input, g_input_size);
+            memset(&msg, 0, sizeof(msg));
+            TEST(pb_decode_arena(&stream, AllTypes_fields, &msg, &arena));
+            TEST(reencode_matches(&msg));
+            TEST(i == 0 || arena.used == used);
+            used = arena.used;
+            pb_arena_reset(&arena);
+        }
+        TEST(get_alloc_count() == 0);
+    }
+    
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+    
+    return status;
+}
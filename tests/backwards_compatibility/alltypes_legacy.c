@@ -3,7 +3,7 @@
 
 #include "alltypes_legacy.h"
 
-#if PB_PROTO_HEADER_VERSION != 30
+#if PB_PROTO_HEADER_VERSION != 31
 #error Regenerate this file with the current version of nanopb generator.
 #endif
 
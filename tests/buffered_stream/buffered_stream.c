@@ -0,0 +1,270 @@
+/* Encodes and decodes a file of length-delimited messages using unbuffered
+ * streams, which access the file in the same way as the socket streams in
+ * examples/network_server, and using the buffered streams from pb_io.c.
+ * Checks that the buffered streams combine the small reads and writes into
+ * one call per buffer.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "pb_io.h"
+#include "person.pb.h"
+#include "unittests.h"
+
+#define MESSAGE_COUNT 5000
+
+/* Longer than any single pb_write() done when encoding a Person */
+#define MAX_WRITE 32
+
+static unsigned long g_calls;
+static unsigned long g_bytes;
+
+/* Unbuffered stream, each pb_read() becomes a read from the file. */
+static bool unbuffered_read(pb_istream_t *stream, uint8_t *buf, size_t count)
+{
+    FILE *file = (FILE*)stream->state;
+    size_t result = fread(buf, 1, count, file);
+    g_calls++;
+    g_bytes += result;
+    
+    if (result == 0 && feof(file))
+        stream->bytes_left = 0; /* EOF */
+    
+    return result == count;
+}
+
+static size_t counting_fill(void *source, uint8_t *buf, size_t count)
+{
+    size_t result = pb_fill_from_file(source, buf, count);
+    g_calls++;
+    g_bytes += result;
+    return result;
+}
+
+/* Unbuffered stream, each pb_write() becomes a write to the file. */
+static bool unbuffered_write(pb_ostream_t *stream, const uint8_t *buf, size_t count)
+{
+    FILE *file = (FILE*)stream->state;
+    g_calls++;
+    g_bytes += count;
+    return fwrite(buf, 1, count, file) == count;
+}
+
+static bool counting_drain(void *sink, const uint8_t *buf, size_t count)
+{
+    g_calls++;
+    g_bytes += count;
+    return pb_drain_to_file(sink, buf, count);
+}
+
+static void fill_person(Person *person, int id)
+{
+    Person tmp = Person_init_default;
+    *person = tmp;
+    sprintf(person->name, "Test Person %d", id);
+    person->id = id;
+    person->has_email = true;
+    sprintf(person->email, "person%d@example.com", id);
+    person->phone_count = 3;
+    strcpy(person->phone[0].number, "555-12345678");
+    strcpy(person->phone[1].number, "99-2342");
+    strcpy(person->phone[2].number, "1234-5678");
+    person->phone[2].has_type = true;
+    person->phone[2].type = Person_PhoneType_WORK;
+}
+
+static bool encode_all(pb_ostream_t *stream)
+{
+    int i;
+    Person person;
+    
+    for (i = 0; i < MESSAGE_COUNT; i++)
+    {
+        fill_person(&person, i);
+        if (!pb_encode_delimited(stream, Person_fields, &person))
+        {
+            printf("Encoding failed: %s\n", PB_GET_ERROR(stream));
+            return false;
+        }
+    }
+    
+    return pb_ostream_flush(stream);
+}
+
+/* Check that the two files have the same contents */
+static bool compare_files(FILE *file1, FILE *file2)
+{
+    int c;
+    rewind(file1);
+    rewind(file2);
+    
+    do {
+        c = getc(file1);
+        if (c != getc(file2))
+            return false;
+    } while (c != EOF);
+    
+    return true;
+}
+
+/* Decode messages until end of file. Returns the number of messages
+ * that were decoded and matched the original, or -1 on error. */
+static int decode_all(pb_istream_t *stream)
+{
+    int count = 0;
+    Person person, expected;
+    
+    while (pb_decode_delimited(stream, Person_fields, &person))
+    {
+        fill_person(&expected, count);
+        if (person.id != expected.id ||
+            strcmp(person.name, expected.name) != 0 ||
+            strcmp(person.email, expected.email) != 0 ||
+            person.phone_count != 3 ||
+            person.phone[2].type != Person_PhoneType_WORK)
+        {
+            return -1;
+        }
+        count++;
+    }
+    
+    if (stream->bytes_left != 0)
+    {
+        printf("Decoding failed: %s\n", PB_GET_ERROR(stream));
+        return -1;
+    }
+    
+    return count;
+}
+
+int main()
+{
+    int status = 0;
+    FILE *file = tmpfile();
+    FILE *file2 = tmpfile();
+    long filesize;
+    unsigned long unbuffered_writes, unbuffered_reads;
+    uint8_t buffer[256];
+    pb_readahead_t readahead;
+    pb_writebuf_t writebuf;
+    
+    if (!file || !file2)
+    {
+        perror("tmpfile");
+        return 1;
+    }
+    
+    {
+        pb_ostream_t stream = {&unbuffered_write, NULL, SIZE_MAX, 0};
+        stream.state = file2;
+        g_calls = g_bytes = 0;
+        
+        COMMENT("Encode with unbuffered stream");
+        TEST(encode_all(&stream));
+        filesize = (long)stream.bytes_written;
+        TEST(g_bytes == (unsigned long)filesize);
+        TEST(g_calls > MESSAGE_COUNT);
+        unbuffered_writes = g_calls;
+    }
+    
+    {
+        pb_ostream_t stream;
+        g_calls = g_bytes = 0;
+        pb_writebuf_init(&writebuf, buffer, sizeof(buffer), &counting_drain, file);
+        stream = pb_ostream_from_writebuf(&writebuf, SIZE_MAX);
+        
+        COMMENT("Encode with buffered stream");
+        TEST(encode_all(&stream));
+        TEST(g_bytes == (unsigned long)filesize);
+        TEST(g_calls < unbuffered_writes / 20);
+        
+        /* The buffer is drained only when the next write does not fit,
+         * so all drains except the last one are nearly full. */
+        TEST(g_calls <= (unsigned long)filesize / (sizeof(buffer) - MAX_WRITE) + 1);
+        TEST(compare_files(file, file2));
+    }
+    
+    {
+        pb_ostream_t stream;
+        Person person;
+        g_calls = g_bytes = 0;
+        pb_writebuf_init(&writebuf, buffer, sizeof(buffer), &counting_drain, file2);
+        stream = pb_ostream_from_writebuf(&writebuf, SIZE_MAX);
+        fill_person(&person, 0);
+        
+        COMMENT("Check that small message is written in one call on flush");
+        TEST(pb_encode(&stream, Person_fields, &person) && g_calls == 0);
+        TEST(pb_ostream_flush(&stream) && g_calls == 1);
+        TEST(g_bytes == stream.bytes_written);
+        TEST(pb_ostream_flush(&stream) && g_calls == 1);
+    }
+    
+    {
+        pb_istream_t stream = {&unbuffered_read, NULL, SIZE_MAX};
+        stream.state = file;
+        rewind(file);
+        g_calls = g_bytes = 0;
+        
+        COMMENT("Decode with unbuffered stream");
+        TEST(decode_all(&stream) == MESSAGE_COUNT);
+        TEST(g_bytes == (unsigned long)filesize);
+        TEST(g_calls > MESSAGE_COUNT);
+        unbuffered_reads = g_calls;
+    }
+    
+    {
+        pb_istream_t stream;
+        rewind(file);
+        g_calls = g_bytes = 0;
+        pb_readahead_init(&readahead, buffer, sizeof(buffer), &counting_fill, file);
+        stream = pb_istream_from_readahead(&readahead, SIZE_MAX);
+        
+        COMMENT("Decode with buffered stream");
+        TEST(decode_all(&stream) == MESSAGE_COUNT);
+        TEST(g_bytes == (unsigned long)filesize);
+        TEST(g_calls < unbuffered_reads / 20);
+        
+        /* One read per buffer, and one more that finds the end of file */
+        TEST(g_calls == ((unsigned long)filesize + sizeof(buffer) - 1) / sizeof(buffer) + 1);
+    }
+    
+    {
+        pb_istream_t stream;
+        rewind(file);
+        stream = pb_istream_from_file(&readahead, file, buffer, sizeof(buffer));
+        
+        COMMENT("Decode with pb_istream_from_file");
+        TEST(decode_all(&stream) == MESSAGE_COUNT);
+    }
+    
+    {
+        pb_istream_t stream;
+        uint64_t length;
+        Person person;
+        rewind(file);
+        g_calls = g_bytes = 0;
+        pb_readahead_init(&readahead, buffer, sizeof(buffer), &counting_fill, file);
+        
+        COMMENT("Check that reads don't go past the end of message");
+        stream = pb_istream_from_readahead(&readahead, 1);
+        TEST(pb_decode_varint(&stream, &length) && length < 128);
+        TEST(g_bytes == 1);
+        stream = pb_istream_from_readahead(&readahead, (size_t)length);
+        TEST(pb_decode(&stream, Person_fields, &person) && person.id == 0);
+        TEST(g_bytes == 1 + length);
+        
+        stream = pb_istream_from_readahead(&readahead, SIZE_MAX);
+        TEST(pb_decode_delimited(&stream, Person_fields, &person) && person.id == 1);
+        TEST(g_bytes > 1 + length);
+    }
+    
+    fclose(file);
+    fclose(file2);
+    
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+    
+    return status;
+}
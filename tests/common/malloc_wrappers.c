@@ -4,6 +4,7 @@
 #include <string.h>
 
 static size_t alloc_count = 0;
+static size_t realloc_count = 0;
 
 /* Allocate memory and place check values before and after. */
 void* malloc_with_check(size_t size)
@@ -35,6 +36,8 @@ void* counting_realloc(void *ptr, size_t size)
     if (!ptr && size)
         alloc_count++;
     
+    realloc_count++;
+    
     return realloc(ptr, size);
 }
 
@@ -52,3 +55,9 @@ size_t get_alloc_count()
 {
     return alloc_count;
 }
+
+/* Number of calls to counting_realloc(), including resizes */
+size_t get_realloc_count()
+{
+    return realloc_count;
+}
@@ -5,3 +5,4 @@ void free_with_check(void *mem);
 void* counting_realloc(void *ptr, size_t size);
 void counting_free(void *ptr);
 size_t get_alloc_count();
+size_t get_realloc_count();
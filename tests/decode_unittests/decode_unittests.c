@@ -103,6 +103,27 @@ int main()
         TEST((s = S("\xFF\xFF\xFF\xFF\xFF\x01"), !pb_decode_varint32(&s, &u)));
     }
     
+    {
+        pb_istream_t s;
+        uint64_t u;
+        uint32_t u32;
+        
+        COMMENT("Test varint decoding with more data in buffer");
+        TEST((s = S("\xAC\x02""foobarfoobar"), pb_decode_varint(&s, &u) && u == 300 && s.bytes_left == 12));
+        TEST((s = S("\xAC\x02""foobarfoobar"), pb_decode_varint32(&s, &u32) && u32 == 300 && s.bytes_left == 12));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01""foo"),
+              pb_decode_varint(&s, &u) && u == UINT64_MAX && s.bytes_left == 3));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01""foo"),
+              !pb_decode_varint(&s, &u)));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\x01""foo"), !pb_decode_varint32(&s, &u32)));
+        TEST((s = S("\x80\x80\x80\x80\x01""foo"), pb_decode_varint32(&s, &u32) && u32 == (1UL << 28) && s.bytes_left == 3));
+        TEST((s = S("\xFF\xFF\xFF\xFF\x0F""foo"), pb_decode_varint32(&s, &u32) && u32 == UINT32_MAX && s.bytes_left == 3));
+        TEST((s = S("\xFF\xFF\x03""foobarfoobar"), pb_decode_varint(&s, &u) && u == 65535 && s.bytes_left == 12));
+        TEST((s = S("\x80\x80\x80\x80\x10""foobar"), pb_decode_varint(&s, &u) && u == ((uint64_t)1 << 32) && s.bytes_left == 6));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x7F""foo"),
+              pb_decode_varint(&s, &u) && u == UINT64_MAX / 2 && s.bytes_left == 3));
+    }
+    
     {
         pb_istream_t s;
         COMMENT("Test pb_skip_varint");
@@ -246,6 +267,21 @@ int main()
         TEST((s = S("\x0A\x01"), !pb_decode(&s, IntegerArray_fields, &dest)))
     }
     
+    {
+        pb_istream_t s;
+        FloatArray dest;
+        
+        COMMENT("Testing pb_decode with packed float field")
+        TEST((s = S("\x0A\x08\x00\x00\x80\x3F\x00\x00\x00\x40"), pb_decode(&s, FloatArray_fields, &dest)
+            && dest.data_count == 2 && dest.data[0] == 1.0f && dest.data[1] == 2.0f))
+        TEST((s = S("\x0D\x00\x00\x80\x3F\x0A\x04\x00\x00\x00\x40"), pb_decode(&s, FloatArray_fields, &dest)
+            && dest.data_count == 2 && dest.data[0] == 1.0f && dest.data[1] == 2.0f))
+        TEST((s = S("\x0A\x28" "0000111122223333444455556666777788889999"), pb_decode(&s, FloatArray_fields, &dest)
+            && dest.data_count == 10 && memcmp(&dest.data[9], "9999", 4) == 0))
+        TEST((s = S("\x0A\x2C" "00001111222233334444555566667777888899990000"), !pb_decode(&s, FloatArray_fields, &dest)))
+        TEST((s = S("\x0A\x06\x00\x00\x80\x3F\x00\x00"), !pb_decode(&s, FloatArray_fields, &dest)))
+    }
+    
     {
         pb_istream_t s;
         IntegerArray dest;
@@ -0,0 +1,78 @@
+/* Decodes messages that are initialized from the generated default image,
+ * and checks that the values are the same as with field-by-field
+ * initialization.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include "default_image.pb.h"
+#include "unittests.h"
+
+static bool dummy_callback(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+    PB_UNUSED(stream);
+    PB_UNUSED(field);
+    PB_UNUSED(arg);
+    return true;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[1];
+    Config config;
+    Settings settings;
+
+    COMMENT("Default image is generated only without callback fields")
+    {
+        TEST(Config_info.default_image != NULL);
+        TEST(Config_info.struct_size == sizeof(Config));
+        TEST(Channel_info.default_image != NULL);
+        TEST(Handler_info.default_image == NULL);
+    }
+
+    COMMENT("Same defaults as with field-by-field initialization")
+    {
+        pb_istream_t stream1 = pb_istream_from_buffer(buffer, 0);
+        pb_istream_t stream2 = pb_istream_from_buffer(buffer, 0);
+
+        memset(&config, 0xAA, sizeof(config));
+        memset(&settings, 0xAA, sizeof(settings));
+        TEST(pb_decode(&stream1, Config_fields, &config));
+        TEST(pb_decode(&stream2, Settings_fields, &settings));
+
+        TEST(!config.has_version && config.version == 3);
+        TEST(strcmp(config.label, "default label") == 0);
+        TEST(config.key.size == 3 && config.key.bytes[2] == 3);
+        TEST(!config.has_primary && config.primary.id == 7);
+        TEST(strcmp(config.primary.name, "channel") == 0);
+        TEST(config.channels_count == 0 && config.samples_count == 0);
+        TEST(config.scale == 0.25);
+
+        TEST(config.version == settings.version);
+        TEST(strcmp(config.label, settings.label) == 0);
+        TEST(memcmp(&config.key, &settings.key, sizeof(config.key)) == 0);
+        TEST(memcmp(&config.primary, &settings.primary, sizeof(config.primary)) == 0);
+        TEST(config.scale == settings.scale);
+    }
+
+    COMMENT("Callback fields are preserved")
+    {
+        Handler handler;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, 0);
+
+        memset(&handler, 0, sizeof(handler));
+        handler.data.funcs.decode = &dummy_callback;
+        handler.data.arg = &handler;
+        TEST(pb_decode(&stream, Handler_fields, &handler));
+        TEST(handler.data.funcs.decode == &dummy_callback);
+        TEST(handler.data.arg == &handler);
+        TEST(handler.priority == 10 && handler.channel.id == 7);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
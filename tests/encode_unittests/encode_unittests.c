@@ -173,9 +173,9 @@ int main()
         struct { pb_size_t size; uint8_t bytes[5]; } value = {5, {'x', 'y', 'z', 'z', 'y'}};
     
         COMMENT("Test pb_enc_bytes")
-        TEST(WRITES(pb_enc_bytes(&s, &BytesMessage_fields[0], &value), "\x05xyzzy"))
+        TEST(WRITES(pb_enc_bytes(&s, PB_FIRST_FIELD(BytesMessage_fields), &value), "\x05xyzzy"))
         value.size = 0;
-        TEST(WRITES(pb_enc_bytes(&s, &BytesMessage_fields[0], &value), "\x00"))
+        TEST(WRITES(pb_enc_bytes(&s, PB_FIRST_FIELD(BytesMessage_fields), &value), "\x00"))
     }
     
     {
@@ -184,11 +184,11 @@ int main()
         char value[30] = "xyzzy";
         
         COMMENT("Test pb_enc_string")
-        TEST(WRITES(pb_enc_string(&s, &StringMessage_fields[0], &value), "\x05xyzzy"))
+        TEST(WRITES(pb_enc_string(&s, PB_FIRST_FIELD(StringMessage_fields), &value), "\x05xyzzy"))
         value[0] = '\0';
-        TEST(WRITES(pb_enc_string(&s, &StringMessage_fields[0], &value), "\x00"))
+        TEST(WRITES(pb_enc_string(&s, PB_FIRST_FIELD(StringMessage_fields), &value), "\x00"))
         memset(value, 'x', 30);
-        TEST(WRITES(pb_enc_string(&s, &StringMessage_fields[0], &value), "\x0Axxxxxxxxxx"))
+        TEST(WRITES(pb_enc_string(&s, PB_FIRST_FIELD(StringMessage_fields), &value), "\x0Axxxxxxxxxx"))
     }
     
     {
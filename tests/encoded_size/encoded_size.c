@@ -0,0 +1,85 @@
+/* Checks that pb_get_encoded_size() gives the same result as encoding the
+ * message from stdin, also for integer values at all varint length
+ * boundaries.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+static AllTypes g_alltypes;
+static AllTypes g_varints;
+static uint8_t g_buffer[2048];
+
+/* Returns true if pb_get_encoded_size() agrees with pb_encode() */
+static bool check_size(const AllTypes *msg)
+{
+    pb_ostream_t stream = pb_ostream_from_buffer(g_buffer, sizeof(g_buffer));
+    size_t size;
+
+    if (!pb_encode(&stream, AllTypes_fields, msg) ||
+        !pb_get_encoded_size(&size, AllTypes_fields, msg))
+        return false;
+
+    return size == stream.bytes_written;
+}
+
+int main()
+{
+    int status = 0;
+    size_t count;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(g_buffer, 1, sizeof(g_buffer), stdin);
+
+    COMMENT("Same size as written by pb_encode()")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(g_buffer, count);
+        TEST(pb_decode(&stream, AllTypes_fields, &g_alltypes));
+        TEST(check_size(&g_alltypes));
+    }
+
+    COMMENT("Varint length boundaries")
+    {
+        int shift;
+        size_t errors = 0;
+
+        g_varints = g_alltypes;
+        g_varints.rep_int64_count = 1;
+        g_varints.rep_sint64_count = 1;
+        g_varints.rep_uint64_count = 1;
+
+        for (shift = 0; shift < 64; shift++)
+        {
+            uint64_t values[2];
+            int i;
+
+            values[0] = (uint64_t)1 << shift;
+            values[1] = values[0] - 1;
+
+            for (i = 0; i < 2; i++)
+            {
+                g_varints.req_int64 = (int64_t)values[i];
+                g_varints.req_uint64 = values[i];
+                g_varints.req_sint64 = (int64_t)values[i];
+                g_varints.rep_int64[0] = (int64_t)(0 - values[i]);
+                g_varints.rep_uint64[0] = ~values[i];
+                g_varints.rep_sint64[0] = (int64_t)(0 - values[i]);
+
+                if (!check_size(&g_varints))
+                    errors++;
+            }
+        }
+
+        TEST(errors == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,158 @@
+/* Decodes a message with many extension fields with the plain extension
+ * list and with pb_extension_index_t, and checks that the results are the
+ * same.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "many_extensions.pb.h"
+#include "unittests.h"
+
+#define EXT_COUNT 64
+static const pb_extension_type_t * const ext_types[EXT_COUNT] = {
+    &Base_ext0, &Base_ext1, &Base_ext2, &Base_ext3,
+    &Base_ext4, &Base_ext5, &Base_ext6, &Base_ext7,
+    &Base_ext8, &Base_ext9, &Base_ext10, &Base_ext11,
+    &Base_ext12, &Base_ext13, &Base_ext14, &Base_ext15,
+    &Base_ext16, &Base_ext17, &Base_ext18, &Base_ext19,
+    &Base_ext20, &Base_ext21, &Base_ext22, &Base_ext23,
+    &Base_ext24, &Base_ext25, &Base_ext26, &Base_ext27,
+    &Base_ext28, &Base_ext29, &Base_ext30, &Base_ext31,
+    &Base_ext32, &Base_ext33, &Base_ext34, &Base_ext35,
+    &Base_ext36, &Base_ext37, &Base_ext38, &Base_ext39,
+    &Base_ext40, &Base_ext41, &Base_ext42, &Base_ext43,
+    &Base_ext44, &Base_ext45, &Base_ext46, &Base_ext47,
+    &Base_ext48, &Base_ext49, &Base_ext50, &Base_ext51,
+    &Base_ext52, &Base_ext53, &Base_ext54, &Base_ext55,
+    &Base_ext56, &Base_ext57, &Base_ext58, &Base_ext59,
+    &Base_ext60, &Base_ext61, &Base_ext62, &Base_ext63
+};
+
+static pb_extension_t g_exts[EXT_COUNT];
+static int32_t g_values[EXT_COUNT];
+static unsigned g_unknown;
+
+/* Catch-all handler that skips the fields that no other extension took */
+static bool count_unknown(pb_istream_t *stream, pb_extension_t *extension,
+                          uint32_t tag, pb_wire_type_t wire_type)
+{
+    PB_UNUSED(extension);
+    PB_UNUSED(tag);
+    g_unknown++;
+    return pb_skip_field(stream, wire_type);
+}
+
+static pb_extension_type_t g_unknown_type = {&count_unknown, NULL, NULL};
+static pb_extension_t g_unknown_ext;
+static char g_unknown_text[16];
+
+/* Link the extensions into a list in tag order, with the catch-all last */
+static pb_extension_t *make_list(void)
+{
+    int i;
+    for (i = 0; i < EXT_COUNT; i++)
+    {
+        g_exts[i].type = ext_types[i];
+        g_exts[i].dest = &g_values[i];
+        g_exts[i].next = &g_exts[i + 1];
+        g_exts[i].found = false;
+    }
+    g_exts[EXT_COUNT - 1].next = &g_unknown_ext;
+
+    /* The decoder initializes the dest of every extension in the list
+     * according to the field in arg. */
+    g_unknown_type.arg = Base_unknown.arg;
+    g_unknown_ext.type = &g_unknown_type;
+    g_unknown_ext.dest = g_unknown_text;
+    g_unknown_ext.next = NULL;
+    return &g_exts[0];
+}
+
+static bool check_values(void)
+{
+    int i;
+    for (i = 0; i < EXT_COUNT; i++)
+    {
+        if (!g_exts[i].found || g_values[i] != i * 1000 + 1)
+            return false;
+    }
+    return true;
+}
+
+static bool decode(uint8_t *buffer, size_t size, pb_extension_t *extensions)
+{
+    Base msg;
+    pb_istream_t stream = pb_istream_from_buffer(buffer, size);
+    memset(g_values, 0, sizeof(g_values));
+    g_unknown = 0;
+    msg.extensions = extensions;
+    return pb_decode(&stream, Base_fields, &msg) && msg.id == 42;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[1024];
+    size_t size;
+    pb_extension_t *entries[EXT_COUNT + 1];
+    pb_extension_index_t index;
+
+    COMMENT("Encode all extensions and one unknown field")
+    {
+        Base msg = {0};
+        pb_extension_t unknown;
+        char text[16] = "unknown";
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        int i;
+
+        for (i = 0; i < EXT_COUNT; i++)
+            g_values[i] = i * 1000 + 1;
+
+        msg.id = 42;
+        msg.extensions = make_list();
+        g_exts[EXT_COUNT - 1].next = &unknown;
+        unknown.type = &Base_unknown;
+        unknown.dest = text;
+        unknown.next = NULL;
+        TEST(pb_encode(&stream, Base_fields, &msg));
+        size = stream.bytes_written;
+    }
+
+    COMMENT("Build the index")
+    {
+        pb_extension_t *list = make_list();
+        TEST(!pb_extension_index_init(&index, list, entries, EXT_COUNT));
+        TEST(pb_extension_index_init(&index, list, entries, EXT_COUNT + 1));
+        TEST(index.count == EXT_COUNT + 1 && index.default_count == EXT_COUNT);
+        TEST(index.entries[EXT_COUNT] == &g_unknown_ext);
+    }
+
+    COMMENT("Same results with and without the index")
+    {
+        TEST(decode(buffer, size, &g_exts[0]));
+        TEST(check_values() && g_unknown == 1);
+        TEST(decode(buffer, size, &index.head));
+        TEST(check_values() && g_unknown == 1);
+        TEST(!index.head.found);
+    }
+
+    COMMENT("Index is encoded as the rest of the list")
+    {
+        Base msg = {0};
+        uint8_t buffer2[1024];
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+        msg.id = 42;
+        msg.extensions = &index.head;
+        g_exts[EXT_COUNT - 1].next = NULL;
+        TEST(pb_encode(&stream, Base_fields, &msg));
+        TEST(stream.bytes_written < size && memcmp(buffer, buffer2, stream.bytes_written) == 0);
+        g_exts[EXT_COUNT - 1].next = &g_unknown_ext;
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,159 @@
+/* Checks that pb_field_iter_find() gives the same result with the
+ * generated lookup tables as with a linear search, for all tag numbers.
+ * Also decodes a message with unknown fields whose tags map to slots of
+ * known fields in the hash table.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "field_lookup.pb.h"
+#include "unittests.h"
+
+#define MAX_TAG 255
+
+static uint8_t g_buffer[256];
+
+/* Returns true if the tag is not a field of the message, but maps to a
+ * slot that is used by another field. */
+static bool is_collision(const pb_msginfo_t *info, const pb_field_t *fields, uint32_t tag)
+{
+    uint32_t index;
+    
+    if (info->tag_mult == 0)
+        return false;
+    
+    index = (uint32_t)(tag * info->tag_mult) >> info->tag_shift;
+    return info->tag_index[index] != 0 && fields[info->tag_index[index]].tag != tag;
+}
+
+/* Look up all tags with the tables and by searching the list without the
+ * pb_msginfo_t entry. Returns number of differences. */
+static int compare_lookup(const pb_field_t *fields, void *msg, int *collisions)
+{
+    int errors = 0;
+    uint32_t tag;
+    
+    for (tag = 1; tag <= MAX_TAG; tag++)
+    {
+        pb_field_iter_t indexed, linear;
+        bool found1, found2;
+        
+        if (!pb_field_iter_begin(&indexed, fields, msg) ||
+            !pb_field_iter_begin(&linear, PB_FIRST_FIELD(fields), msg))
+            return 1;
+        
+        if (indexed.info == NULL || linear.info != NULL)
+            return 1;
+        
+        found1 = pb_field_iter_find(&indexed, tag);
+        found2 = pb_field_iter_find(&linear, tag);
+        
+        if (found1 != found2)
+            errors++;
+        else if (found1 && (indexed.pos != linear.pos ||
+                            indexed.pData != linear.pData ||
+                            indexed.pSize != linear.pSize ||
+                            indexed.required_field_index != linear.required_field_index))
+            errors++;
+        
+        if (!found1 && is_collision(indexed.info, fields, tag))
+            (*collisions)++;
+    }
+    
+    return errors;
+}
+
+int main()
+{
+    int status = 0;
+    
+    COMMENT("Table types");
+    TEST(Dense_info.tag_index != NULL && Dense_info.tag_mult == 0);
+    TEST(Sparse_info.tag_index != NULL && Sparse_info.tag_mult != 0);
+    TEST(Sparse_info.tag_index_size < 250);
+    
+    {
+        Dense dense;
+        Sparse sparse;
+        int collisions = 0;
+        
+        COMMENT("Same fields found as with linear search");
+        TEST(compare_lookup(Dense_fields, &dense, &collisions) == 0);
+        TEST(compare_lookup(Sparse_fields, &sparse, &collisions) == 0);
+        TEST(collisions > 0);
+    }
+    
+    {
+        Sparse msg = Sparse_init_zero;
+        Sparse indexed, linear;
+        pb_ostream_t ostream = pb_ostream_from_buffer(g_buffer, sizeof(g_buffer));
+        pb_istream_t istream;
+        size_t size;
+        uint32_t tag;
+        int unknown = 0;
+        
+        COMMENT("Decode message with colliding unknown fields");
+        msg.a = 1;
+        msg.has_b = true;
+        msg.b = 17;
+        msg.c_count = 2;
+        msg.c[0] = 60;
+        msg.c[1] = 61;
+        strcpy(msg.d, "hundred");
+        msg.has_sub = true;
+        msg.sub.x = 200;
+        msg.sub.w = 5;
+        msg.sub.has_w = true;
+        msg.which_choice = Sparse_e_tag;
+        msg.choice.e = 240;
+        TEST(pb_encode(&ostream, Sparse_fields, &msg));
+        
+        /* Add unknown fields, which should be skipped */
+        for (tag = 1; tag <= MAX_TAG && unknown < 8; tag++)
+        {
+            if (is_collision(&Sparse_info, Sparse_fields, tag))
+            {
+                if (!pb_encode_tag(&ostream, PB_WT_VARINT, tag) ||
+                    !pb_encode_varint(&ostream, 12345))
+                    status = 1;
+                unknown++;
+            }
+        }
+        TEST(unknown == 8);
+        size = ostream.bytes_written;
+        
+        /* The padding between fields is only set when the default image
+         * from the tables is used, so start from zeroes for comparison. */
+        memset(&indexed, 0, sizeof(indexed));
+        istream = pb_istream_from_buffer(g_buffer, size);
+        TEST(pb_decode(&istream, Sparse_fields, &indexed));
+        
+        memset(&linear, 0, sizeof(linear));
+        istream = pb_istream_from_buffer(g_buffer, size);
+        TEST(pb_decode(&istream, PB_FIRST_FIELD(Sparse_fields), &linear));
+        
+        TEST(memcmp(&indexed, &linear, sizeof(Sparse)) == 0);
+        TEST(indexed.a == 1 && indexed.b == 17 && indexed.c_count == 2 && indexed.c[1] == 61);
+        TEST(strcmp(indexed.d, "hundred") == 0);
+        TEST(indexed.sub.x == 200 && indexed.sub.w == 5 && !indexed.sub.has_y);
+        TEST(indexed.which_choice == Sparse_e_tag && indexed.choice.e == 240);
+    }
+    
+    {
+        /* Tag 130 is a required field */
+        uint8_t missing[] = {0x08, 0x01};
+        Sparse msg;
+        pb_istream_t stream = pb_istream_from_buffer(missing, sizeof(missing));
+        
+        COMMENT("Missing required field");
+        TEST(!pb_decode(&stream, Sparse_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&stream), "missing required field") == 0);
+    }
+    
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+    
+    return status;
+}
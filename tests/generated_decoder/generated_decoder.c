@@ -0,0 +1,241 @@
+/* Decodes the same messages with pb_decode() and with the generated
+ * decoding functions, and checks that the resulting structures are
+ * identical. Also checks the error cases.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "generated_decoder.pb.h"
+#include "unittests.h"
+
+static void fill_point(Point *point, int32_t x, int32_t y)
+{
+    point->x = x;
+    point->y = y;
+    point->has_label = true;
+    sprintf(point->label, "(%d,%d)", (int)x, (int)y);
+}
+
+static void fill_record(Record *record)
+{
+    pb_size_t i;
+
+    record->req_int32 = -1001;
+    record->req_int64 = -1002;
+    record->req_uint32 = 1003;
+    record->req_uint64 = 1004;
+    record->req_sint32 = -1005;
+    record->req_sint64 = -1006;
+    record->req_bool = true;
+    record->req_fixed32 = 1008;
+    record->req_sfixed32 = -1009;
+    record->req_float = 1010.0f;
+    record->req_fixed64 = 1011;
+    record->req_sfixed64 = -1012;
+    record->req_double = 1013.0;
+    strcpy(record->req_string, "required");
+    record->req_bytes.size = 4;
+    memcpy(record->req_bytes.bytes, "\x00\x01\x02\x03", 4);
+    fill_point(&record->req_point, 1, 2);
+    record->req_color = Color_BLUE;
+
+    record->has_opt_int32 = true;
+    record->opt_int32 = 3041;
+    record->has_opt_point = true;
+    fill_point(&record->opt_point, -3, -4);
+    record->has_small_int = true;
+    record->small_int = -100;
+
+    record->rep_int32_count = 10;
+    record->rep_sint64_count = 10;
+    record->rep_fixed32_count = 10;
+    for (i = 0; i < 10; i++)
+    {
+        record->rep_int32[i] = (int32_t)i * 1000 - 5000;
+        record->rep_sint64[i] = (int64_t)i * 100000 - 300000;
+        record->rep_fixed32[i] = i;
+    }
+    record->rep_double_count = 2;
+    record->rep_double[0] = 0.5;
+    record->rep_double[1] = -0.25;
+    record->rep_string_count = 2;
+    strcpy(record->rep_string[0], "first");
+    strcpy(record->rep_string[1], "second");
+    record->rep_point_count = 3;
+    for (i = 0; i < 3; i++)
+        fill_point(&record->rep_point[i], (int32_t)i, -(int32_t)i);
+
+    record->which_choice = Record_choice_point_tag;
+    fill_point(&record->choice.choice_point, 5, 6);
+}
+
+static size_t encode_record(const Record *record, uint8_t *buffer, size_t size)
+{
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, size);
+    if (!pb_encode(&stream, Record_fields, record))
+        return 0;
+    return stream.bytes_written;
+}
+
+/* Decode with both decoders into structures that start out identical.
+ * Returns true if both gave the same result and the same status. */
+static bool decode_both(const uint8_t *buffer, size_t msglen, bool *status)
+{
+    Record table, generated;
+    bool status1, status2;
+    pb_istream_t stream1 = pb_istream_from_buffer((uint8_t*)buffer, msglen);
+    pb_istream_t stream2 = pb_istream_from_buffer((uint8_t*)buffer, msglen);
+
+    memset(&table, 0x55, sizeof(table));
+    memset(&generated, 0x55, sizeof(generated));
+    status1 = pb_decode(&stream1, Record_fields, &table);
+    status2 = Record_decode(&stream2, &generated);
+    *status = status1;
+
+    if (status1 != status2)
+        return false;
+
+    if (!status1)
+        return strcmp(PB_GET_ERROR(&stream1), PB_GET_ERROR(&stream2)) == 0;
+
+    return memcmp(&table, &generated, sizeof(table)) == 0;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[1024];
+    size_t msglen;
+    Record record = Record_init_zero;
+    bool ok;
+
+    fill_record(&record);
+    msglen = encode_record(&record, buffer, sizeof(buffer));
+    TEST(msglen > 0);
+
+    COMMENT("Same result as pb_decode()")
+    {
+        TEST(decode_both(buffer, msglen, &ok) && ok);
+    }
+
+    COMMENT("Default values")
+    {
+        Record defaults;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, msglen);
+        TEST(Record_decode(&stream, &defaults));
+        TEST(!defaults.has_opt_string && strcmp(defaults.opt_string, "default") == 0);
+        TEST(defaults.opt_bytes.size == 2 && defaults.opt_bytes.bytes[1] == 2);
+        TEST(defaults.opt_color == Color_GREEN);
+    }
+
+    COMMENT("Other oneof member and missing optional fields")
+    {
+        Record other = Record_init_zero;
+        size_t len;
+        fill_record(&other);
+        other.which_choice = Record_choice_number_tag;
+        other.choice.choice_number = 1234;
+        other.has_opt_point = false;
+        other.rep_point_count = 0;
+        len = encode_record(&other, buffer, sizeof(buffer));
+        TEST(len > 0 && decode_both(buffer, len, &ok) && ok);
+        
+        {
+            pb_istream_t stream = pb_istream_from_buffer(buffer, len);
+            TEST(Record_decode(&stream, &other));
+            TEST(!other.has_opt_point && strcmp(other.opt_point.label, "origin") == 0);
+            TEST(other.choice.choice_number == 1234);
+        }
+    }
+
+    COMMENT("Error cases")
+    {
+        Record bad = Record_init_zero;
+        size_t len;
+
+        /* Truncated message */
+        msglen = encode_record(&record, buffer, sizeof(buffer));
+        TEST(decode_both(buffer, msglen - 3, &ok) && !ok);
+
+        /* Missing required field: only the submessage is present */
+        {
+            pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+            TEST(pb_encode_tag(&stream, PB_WT_STRING, Record_req_point_tag));
+            TEST(pb_encode_submessage(&stream, Point_fields, &record.req_point));
+            TEST(decode_both(buffer, stream.bytes_written, &ok) && !ok);
+        }
+
+        /* Too long string */
+        {
+            pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+            TEST(pb_encode_tag(&stream, PB_WT_STRING, Record_req_string_tag));
+            TEST(pb_encode_string(&stream, (const uint8_t*)"0123456789012345678901234567890123456789", 40));
+            TEST(decode_both(buffer, stream.bytes_written, &ok) && !ok);
+        }
+
+        /* Too large value for an 8-bit field */
+        {
+            pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+            TEST(pb_encode_tag(&stream, PB_WT_VARINT, Record_small_int_tag));
+            TEST(pb_encode_varint(&stream, 1000));
+            TEST(decode_both(buffer, stream.bytes_written, &ok) && !ok);
+        }
+
+        /* Bool values other than 0 and 1 */
+        {
+            pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+            record.req_bool = false;
+            TEST(pb_encode(&stream, Record_fields, &record));
+            TEST(pb_encode_tag(&stream, PB_WT_VARINT, Record_req_bool_tag));
+            TEST(pb_encode_varint(&stream, 2));
+            TEST(decode_both(buffer, stream.bytes_written, &ok) && ok);
+
+            stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+            TEST(pb_encode(&stream, Record_fields, &record));
+            TEST(pb_encode_tag(&stream, PB_WT_VARINT, Record_req_bool_tag));
+            TEST(pb_encode_varint(&stream, 128));
+            TEST(decode_both(buffer, stream.bytes_written, &ok) && !ok);
+            record.req_bool = true;
+        }
+
+        /* Bytes field of the largest length that fits in the structure,
+         * and one byte longer. The limit includes any padding at the end. */
+        {
+            static const uint8_t data[64] = {0};
+            size_t maxlen = sizeof(record.opt_bytes) - PB_BYTES_ARRAY_T_ALLOCSIZE(0);
+            pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+            TEST(pb_encode(&stream, Record_fields, &record));
+            TEST(pb_encode_tag(&stream, PB_WT_STRING, Record_opt_bytes_tag));
+            TEST(pb_encode_string(&stream, data, maxlen));
+            TEST(decode_both(buffer, stream.bytes_written, &ok) && ok);
+
+            stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+            TEST(pb_encode(&stream, Record_fields, &record));
+            TEST(pb_encode_tag(&stream, PB_WT_STRING, Record_opt_bytes_tag));
+            TEST(pb_encode_string(&stream, data, maxlen + 1));
+            TEST(decode_both(buffer, stream.bytes_written, &ok) && !ok);
+        }
+
+        /* Too many items in a packed array */
+        fill_record(&bad);
+        bad.rep_sint64_count = 10;
+        len = encode_record(&bad, buffer, sizeof(buffer));
+        TEST(len > 0);
+        {
+            /* Append a second packed block, which overflows the array */
+            pb_ostream_t stream = pb_ostream_from_buffer(buffer + len, sizeof(buffer) - len);
+            TEST(pb_encode_tag(&stream, PB_WT_STRING, Record_rep_sint64_tag));
+            TEST(pb_encode_varint(&stream, 2));
+            TEST(pb_encode_svarint(&stream, 1));
+            TEST(pb_encode_svarint(&stream, 2));
+            TEST(decode_both(buffer, len + stream.bytes_written, &ok) && !ok);
+        }
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,113 @@
+/* Encodes the same messages with pb_encode() and with the generated
+ * encoding functions, and checks that the output is identical.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include "generated_encoder.pb.h"
+#include "unittests.h"
+
+static bool write_blob(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+    const char *text = (const char*)*arg;
+    return pb_encode_tag_for_field(stream, field) &&
+           pb_encode_string(stream, (const uint8_t*)text, strlen(text));
+}
+
+static void fill_sample(Sample *sample)
+{
+    pb_size_t i;
+
+    sample->timestamp = 1234567890123ULL;
+    sample->sequence = 77;
+    sample->readings_count = 8;
+    for (i = 0; i < 8; i++)
+    {
+        sample->readings[i].sensor = i;
+        sample->readings[i].value = (float)i * 0.5f;
+        sample->readings[i].has_offset = (i % 2 == 0);
+        sample->readings[i].offset = -(int32_t)i;
+    }
+    sample->history_count = 16;
+    for (i = 0; i < 16; i++)
+        sample->history[i] = (int32_t)(i * i * 1000) - 50000;
+    sample->has_source = true;
+    strcpy(sample->source, "probe");
+    sample->blob.funcs.encode = &write_blob;
+    sample->blob.arg = (void*)"blob data";
+    sample->which_status = Sample_error_tag;
+    strcpy(sample->status.error, "overheat");
+}
+
+/* Encode with both encoders, returns true if the outputs are identical */
+static bool encode_both(const Sample *sample, bool *status)
+{
+    uint8_t buffer1[512], buffer2[512];
+    pb_ostream_t stream1 = pb_ostream_from_buffer(buffer1, sizeof(buffer1));
+    pb_ostream_t stream2 = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+    bool status1, status2;
+
+    status1 = pb_encode(&stream1, Sample_fields, sample);
+    status2 = Sample_encode(&stream2, sample);
+    *status = status1;
+
+    if (status1 != status2)
+        return false;
+
+    if (!status1)
+        return strcmp(PB_GET_ERROR(&stream1), PB_GET_ERROR(&stream2)) == 0;
+
+    return stream1.bytes_written == stream2.bytes_written &&
+           memcmp(buffer1, buffer2, stream1.bytes_written) == 0;
+}
+
+int main()
+{
+    int status = 0;
+    Sample sample = Sample_init_zero;
+    bool ok;
+
+    fill_sample(&sample);
+
+    COMMENT("Same output as pb_encode()")
+    {
+        TEST(encode_both(&sample, &ok) && ok);
+
+        sample.which_status = Sample_ok_tag;
+        sample.status.ok = true;
+        sample.has_source = false;
+        sample.readings_count = 0;
+        sample.blob.funcs.encode = NULL;
+        TEST(encode_both(&sample, &ok) && ok);
+        fill_sample(&sample);
+    }
+
+    COMMENT("Sizing")
+    {
+        pb_ostream_t stream1 = PB_OSTREAM_SIZING;
+        pb_ostream_t stream2 = PB_OSTREAM_SIZING;
+        TEST(pb_encode(&stream1, Sample_fields, &sample));
+        TEST(Sample_encode(&stream2, &sample));
+        TEST(stream1.bytes_written == stream2.bytes_written);
+    }
+
+    COMMENT("Error cases")
+    {
+        sample.history_count = 17;
+        TEST(encode_both(&sample, &ok) && !ok);
+        fill_sample(&sample);
+
+        {
+            uint8_t buffer[16];
+            pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+            TEST(!Sample_encode(&stream, &sample));
+            TEST(strcmp(PB_GET_ERROR(&stream), "stream full") == 0);
+        }
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
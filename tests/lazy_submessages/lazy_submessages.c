@@ -0,0 +1,124 @@
+/* Decodes an envelope with lazy submessages, checks that the submessages
+ * can be decoded through the accessors and that the envelope is forwarded
+ * byte for byte, also after changing the header.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "lazy_submessages.pb.h"
+#include "unittests.h"
+
+static void fill_payload(Payload *payload, int32_t first, const char *note)
+{
+    pb_size_t i;
+    payload->values_count = 3;
+    for (i = 0; i < 3; i++)
+        payload->values[i] = first + (int32_t)i;
+    payload->has_note = true;
+    strcpy(payload->note, note);
+}
+
+static bool payload_matches(const Payload *payload, int32_t first, const char *note)
+{
+    return payload->values_count == 3 &&
+           payload->values[0] == first && payload->values[2] == first + 2 &&
+           payload->has_note && strcmp(payload->note, note) == 0;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[512];
+    uint8_t buffer2[512];
+    size_t msglen;
+    EagerEnvelope eager = EagerEnvelope_init_zero;
+    Envelope lazy;
+    Payload payload;
+    
+    eager.header.id = 7;
+    eager.header.has_route = true;
+    strcpy(eager.header.route, "north");
+    eager.has_payload = true;
+    fill_payload(&eager.payload, 100, "main");
+    eager.parts_count = 2;
+    fill_payload(&eager.parts[0], 200, "part 0");
+    fill_payload(&eager.parts[1], 300, "part 1");
+    
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        TEST(pb_encode(&stream, EagerEnvelope_fields, &eager));
+        msglen = stream.bytes_written;
+    }
+    
+    COMMENT("Decode with lazy submessages")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, msglen);
+        memset(&lazy, 0xAA, sizeof(lazy));
+        TEST(pb_decode(&stream, Envelope_fields, &lazy));
+        TEST(lazy.header.id == 7 && strcmp(lazy.header.route, "north") == 0);
+        TEST(lazy.has_payload);
+        TEST(lazy.payload.ptr > buffer && lazy.payload.ptr < buffer + msglen);
+        TEST(lazy.parts_count == 2);
+    }
+    
+    COMMENT("Decode submessages on access")
+    {
+        TEST(Envelope_payload_decode(&lazy, &payload));
+        TEST(payload_matches(&payload, 100, "main"));
+        TEST(Envelope_parts_decode(&lazy, 1, &payload));
+        TEST(payload_matches(&payload, 300, "part 1"));
+        TEST(Envelope_parts_decode(&lazy, 0, &payload));
+        TEST(payload_matches(&payload, 200, "part 0"));
+    }
+    
+    COMMENT("Forward unchanged")
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+        TEST(pb_encode(&stream, Envelope_fields, &lazy));
+        TEST(stream.bytes_written == msglen);
+        TEST(memcmp(buffer, buffer2, msglen) == 0);
+    }
+    
+    COMMENT("Forward with a changed header and a replaced part")
+    {
+        uint8_t partbuf[64];
+        pb_ostream_t partstream = pb_ostream_from_buffer(partbuf, sizeof(partbuf));
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+        pb_istream_t istream;
+        
+        fill_payload(&payload, 400, "new part");
+        TEST(pb_encode(&partstream, Payload_fields, &payload));
+        lazy.parts[1].ptr = partbuf;
+        lazy.parts[1].size = (pb_size_t)partstream.bytes_written;
+        
+        lazy.header.id = 8;
+        strcpy(lazy.header.route, "south");
+        TEST(pb_encode(&stream, Envelope_fields, &lazy));
+        
+        istream = pb_istream_from_buffer(buffer2, stream.bytes_written);
+        memset(&eager, 0, sizeof(eager));
+        TEST(pb_decode(&istream, EagerEnvelope_fields, &eager));
+        TEST(eager.header.id == 8 && strcmp(eager.header.route, "south") == 0);
+        TEST(eager.has_payload && payload_matches(&eager.payload, 100, "main"));
+        TEST(eager.parts_count == 2);
+        TEST(payload_matches(&eager.parts[0], 200, "part 0"));
+        TEST(payload_matches(&eager.parts[1], 400, "new part"));
+    }
+    
+    COMMENT("Corrupted submessage fails on access")
+    {
+        Envelope broken = Envelope_init_zero;
+        static const uint8_t garbage[] = {0x08};
+        broken.has_payload = true;
+        broken.payload.ptr = garbage;
+        broken.payload.size = sizeof(garbage);
+        TEST(!Envelope_payload_decode(&broken, &payload));
+    }
+    
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+    
+    return status;
+}
@@ -0,0 +1,174 @@
+/* Encodes packed integer arrays with different value distributions, then
+ * decodes them to both static and pointer fields and checks that the
+ * values match.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "packed_arrays.pb.h"
+#include "malloc_wrappers.h"
+#include "unittests.h"
+
+#define COUNT 1000
+
+static uint8_t g_buffer[PackedArrays_size];
+static PackedArrays g_original;
+static PackedArrays g_decoded;
+
+/* Simple pseudo-random number generator, so that results are repeatable */
+static uint32_t g_seed = 1;
+static uint32_t random32(void)
+{
+    g_seed = g_seed * 1103515245U + 12345U;
+    return g_seed;
+}
+
+/* Random value with a random number of bits, or up to 6 bits if small */
+static int64_t random_value(bool small)
+{
+    int bits = small ? 6 : (int)(random32() % 63);
+    int64_t value = (int64_t)(((uint64_t)random32() << 32 | random32()) & (((uint64_t)1 << bits) - 1));
+    return (random32() & 1) ? -value : value;
+}
+
+/* Fill the arrays. Mode 0 has only small values, mode 1 has a large value
+ * every 5 items and mode 2 has values of random sizes. */
+static void fill_arrays(PackedArrays *msg, int mode)
+{
+    int i;
+    memset(msg, 0, sizeof(*msg));
+    
+    for (i = 0; i < COUNT; i++)
+    {
+        bool small = (mode == 0) || (mode == 1 && i % 5 != 0);
+        msg->int32s[i] = (int32_t)random_value(small);
+        msg->uint32s[i] = (uint32_t)random_value(small);
+        msg->sint32s[i] = (int32_t)random_value(small);
+        msg->sint64s[i] = random_value(small);
+        msg->int64s[i] = random_value(small);
+        msg->int8s[i] = (int8_t)random_value(small);
+        msg->uint16s[i] = (uint16_t)random_value(small);
+        msg->bools[i] = (random32() & 1);
+    }
+    
+    msg->int32s_count = msg->uint32s_count = msg->sint32s_count = COUNT;
+    msg->sint64s_count = msg->int64s_count = msg->int8s_count = COUNT;
+    msg->uint16s_count = msg->bools_count = COUNT;
+}
+
+#define SAME_ARRAY(a, b, field) \
+    ((a)->field ## _count == (b)->field ## _count && \
+     memcmp((a)->field, (b)->field, (b)->field ## _count * sizeof((b)->field[0])) == 0)
+
+static bool compare_static(const PackedArrays *a, const PackedArrays *b)
+{
+    return SAME_ARRAY(a, b, int32s) && SAME_ARRAY(a, b, uint32s) &&
+           SAME_ARRAY(a, b, sint32s) && SAME_ARRAY(a, b, sint64s) &&
+           SAME_ARRAY(a, b, int64s) && SAME_ARRAY(a, b, int8s) &&
+           SAME_ARRAY(a, b, uint16s) && SAME_ARRAY(a, b, bools);
+}
+
+static bool compare_pointer(const PointerArrays *a, const PackedArrays *b)
+{
+    return SAME_ARRAY(a, b, int32s) && SAME_ARRAY(a, b, uint32s) &&
+           SAME_ARRAY(a, b, sint32s) && SAME_ARRAY(a, b, sint64s) &&
+           SAME_ARRAY(a, b, int64s) && SAME_ARRAY(a, b, int8s) &&
+           SAME_ARRAY(a, b, uint16s) && SAME_ARRAY(a, b, bools);
+}
+
+/* Returns number of errors */
+static int run_test(const char *name, int mode)
+{
+    size_t size;
+    
+    fill_arrays(&g_original, mode);
+    
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(g_buffer, sizeof(g_buffer));
+        if (!pb_encode(&stream, PackedArrays_fields, &g_original))
+        {
+            printf("Encoding failed: %s\n", PB_GET_ERROR(&stream));
+            return 1;
+        }
+        size = stream.bytes_written;
+    }
+    
+    {
+        pb_istream_t stream = pb_istream_from_buffer(g_buffer, size);
+        if (!pb_decode(&stream, PackedArrays_fields, &g_decoded))
+        {
+            printf("Decoding failed: %s\n", PB_GET_ERROR(&stream));
+            return 1;
+        }
+    }
+    
+    if (!compare_static(&g_decoded, &g_original))
+    {
+        printf("Static arrays do not match in %s\n", name);
+        return 1;
+    }
+    
+    {
+        PointerArrays msg = PointerArrays_init_zero;
+        pb_istream_t stream = pb_istream_from_buffer(g_buffer, size);
+        bool ok;
+        
+        if (!pb_decode(&stream, PointerArrays_fields, &msg))
+        {
+            printf("Decoding failed: %s\n", PB_GET_ERROR(&stream));
+            return 1;
+        }
+        
+        ok = compare_pointer(&msg, &g_original);
+        pb_release(PointerArrays_fields, &msg);
+        
+        if (!ok || get_alloc_count() != 0)
+        {
+            printf("Pointer arrays do not match in %s\n", name);
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+int main()
+{
+    int status = 0;
+    
+    COMMENT("Decode packed arrays");
+    TEST(run_test("small", 0) == 0);
+    TEST(run_test("some large", 1) == 0);
+    TEST(run_test("random", 2) == 0);
+    
+    {
+        pb_istream_t stream;
+        PackedArrays msg;
+        uint8_t data[20] = {0x0A, 0x12};
+        
+        COMMENT("Check decoding of small values up to end of message");
+        memset(data + 2, 0x01, 18);
+        data[19] = 0x7F;
+        stream = pb_istream_from_buffer(data, sizeof(data));
+        TEST(pb_decode(&stream, PackedArrays_fields, &msg));
+        TEST(msg.int32s_count == 18 && msg.int32s[0] == 1 && msg.int32s[17] == 127);
+        
+        data[0] = 0x1A;
+        stream = pb_istream_from_buffer(data, sizeof(data));
+        TEST(pb_decode(&stream, PackedArrays_fields, &msg));
+        TEST(msg.sint32s_count == 18 && msg.sint32s[0] == -1 && msg.sint32s[17] == -64);
+        
+        data[0] = 0x3A;
+        data[9] = 0x80; /* Two byte varint */
+        stream = pb_istream_from_buffer(data, sizeof(data));
+        TEST(pb_decode(&stream, PackedArrays_fields, &msg));
+        TEST(msg.uint16s_count == 17 && msg.uint16s[7] == 128 && msg.uint16s[16] == 127);
+    }
+    
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+    
+    return status;
+}
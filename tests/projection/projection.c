@@ -0,0 +1,133 @@
+/* Decodes a record with projections selecting different subsets of its
+ * fields, and checks that only the selected fields are touched.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "projection.pb.h"
+#include "unittests.h"
+
+static uint8_t g_location_mask[PB_PROJECTION_MASK_SIZE(Location_fields_count)];
+static uint8_t g_item_mask[PB_PROJECTION_MASK_SIZE(Item_fields_count)];
+static uint8_t g_record_mask[PB_PROJECTION_MASK_SIZE(Record_fields_count)];
+static const pb_projection_t g_location_projection = {g_location_mask, NULL};
+static const pb_projection_t g_item_projection = {g_item_mask, NULL};
+static const pb_projection_t *g_record_submsgs[Record_fields_count];
+static const pb_projection_t g_record_projection = {g_record_mask, g_record_submsgs};
+
+static void fill_record(Record *record)
+{
+    pb_size_t i, j;
+
+    record->id = 42;
+    record->has_location = true;
+    record->location.lat = 60.5;
+    record->location.lon = 24.25;
+    record->location.has_name = true;
+    strcpy(record->location.name, "office");
+
+    record->items_count = 8;
+    for (i = 0; i < 8; i++)
+    {
+        Item *item = &record->items[i];
+        item->sku = 1000 + i;
+        item->has_title = true;
+        sprintf(item->title, "item number %d", (int)i);
+        item->history_count = 16;
+        for (j = 0; j < 16; j++)
+            item->history[j] = (int32_t)(i * 100 + j);
+    }
+
+    record->has_blob = true;
+    record->blob.size = 200;
+    memset(record->blob.bytes, 0x55, 200);
+    strcpy(record->owner, "someone");
+
+    record->which_origin = Record_home_tag;
+    record->origin.home.lat = 1.5;
+    record->origin.home.lon = 2.5;
+    record->origin.home.has_name = true;
+    strcpy(record->origin.home.name, "home");
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[2048];
+    size_t msglen;
+    Record record = Record_init_zero;
+    Record decoded;
+
+    fill_record(&record);
+
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        TEST(pb_encode(&stream, Record_fields, &record));
+        msglen = stream.bytes_written;
+    }
+
+    PB_PROJECTION_SELECT(g_location_mask, Location_lat_index);
+    PB_PROJECTION_SELECT(g_item_mask, Item_sku_index);
+    PB_PROJECTION_SELECT(g_record_mask, Record_id_index);
+    PB_PROJECTION_SELECT(g_record_mask, Record_location_index);
+    PB_PROJECTION_SELECT(g_record_mask, Record_items_index);
+    PB_PROJECTION_SELECT(g_record_mask, Record_home_index);
+    g_record_submsgs[Record_location_index] = &g_location_projection;
+    g_record_submsgs[Record_items_index] = &g_item_projection;
+    g_record_submsgs[Record_home_index] = &g_location_projection;
+
+    COMMENT("Decode selected fields")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, msglen);
+        memset(&decoded, 0xAA, sizeof(decoded));
+        TEST(pb_decode_projection(&stream, Record_fields, &decoded, &g_record_projection));
+
+        TEST(decoded.id == 42);
+        TEST(decoded.has_location && decoded.location.lat == 60.5);
+        TEST(decoded.items_count == 8);
+        TEST(decoded.items[0].sku == 1000 && decoded.items[7].sku == 1007);
+        TEST(decoded.which_origin == Record_home_tag);
+        TEST(decoded.origin.home.lat == 1.5);
+
+        /* Fields that were not selected are left untouched */
+        TEST(decoded.owner[0] == (char)0xAA);
+        TEST(decoded.blob.bytes[0] == 0xAA);
+        TEST(decoded.location.name[0] == (char)0xAA);
+        TEST(decoded.items[3].title[0] == (char)0xAA);
+    }
+
+    COMMENT("Decode a whole submessage")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, msglen);
+        g_record_submsgs[Record_location_index] = NULL;
+        memset(&decoded, 0xAA, sizeof(decoded));
+        TEST(pb_decode_projection(&stream, Record_fields, &decoded, &g_record_projection));
+        TEST(decoded.location.lon == 24.25);
+        TEST(strcmp(decoded.location.name, "office") == 0);
+        TEST(decoded.items[3].title[0] == (char)0xAA);
+        g_record_submsgs[Record_location_index] = &g_location_projection;
+    }
+
+    COMMENT("Required fields are checked only if selected")
+    {
+        uint8_t mask[PB_PROJECTION_MASK_SIZE(Record_fields_count)] = {0};
+        pb_projection_t projection;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, 0);
+        projection.mask = mask;
+        projection.submsg = NULL;
+
+        TEST(pb_decode_projection(&stream, Record_fields, &decoded, &projection));
+
+        PB_PROJECTION_SELECT(mask, Record_owner_index);
+        stream = pb_istream_from_buffer(buffer, 0);
+        TEST(!pb_decode_projection(&stream, Record_fields, &decoded, &projection));
+        TEST(strcmp(PB_GET_ERROR(&stream), "missing required field") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
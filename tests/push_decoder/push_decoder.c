@@ -0,0 +1,134 @@
+/* Decodes the message from stdin with the push decoder, feeding it in chunks
+ * of all sizes, and checks that the result is the same as with pb_decode().
+ * Also checks that every truncated prefix of the message gives the same
+ * result with both decoders.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+static AllTypes g_pulled;
+static AllTypes g_pushed;
+
+static bool pull_decode(uint8_t *buffer, size_t count)
+{
+    pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+    memset(&g_pulled, 0xAA, sizeof(g_pulled));
+    g_pulled.extensions = NULL;
+    return pb_decode(&stream, AllTypes_fields, &g_pulled);
+}
+
+static bool push_decode(const uint8_t *buffer, size_t count, size_t chunk)
+{
+    pb_decoder_state_t state;
+    size_t pos = 0;
+
+    memset(&g_pushed, 0xAA, sizeof(g_pushed));
+    g_pushed.extensions = NULL;
+    pb_decoder_init(&state, AllTypes_fields, &g_pushed);
+
+    while (pos < count)
+    {
+        size_t size = count - pos;
+        if (size > chunk)
+            size = chunk;
+
+        if (!pb_decode_feed(&state, buffer + pos, size))
+            return false;
+        pos += size;
+    }
+
+    return pb_decode_finish(&state);
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[1024];
+    size_t count;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(buffer, 1, sizeof(buffer), stdin);
+
+    COMMENT("Same result with all chunk sizes")
+    {
+        size_t chunk, errors = 0;
+
+        TEST(pull_decode(buffer, count));
+        for (chunk = 1; chunk <= count; chunk++)
+        {
+            if (!push_decode(buffer, count, chunk) ||
+                memcmp(&g_pulled, &g_pushed, sizeof(AllTypes)) != 0)
+            {
+                errors++;
+            }
+        }
+        TEST(errors == 0);
+        printf("Decoded %u bytes in chunks of 1 to %u bytes\n",
+               (unsigned)count, (unsigned)count);
+    }
+
+    COMMENT("Same result for truncated messages")
+    {
+        size_t length, errors = 0, failures = 0;
+
+        for (length = 0; length < count; length++)
+        {
+            bool pulled = pull_decode(buffer, length);
+            bool pushed = push_decode(buffer, length, 7);
+
+            if (pulled != pushed)
+                errors++;
+            else if (pulled && memcmp(&g_pulled, &g_pushed, sizeof(AllTypes)) != 0)
+                errors++;
+
+            if (!pushed)
+                failures++;
+        }
+        TEST(errors == 0);
+        TEST(failures > 0);
+    }
+
+    COMMENT("Zero tag at the end of a submessage")
+    {
+        /* opt_submsg with substuff1 = "x", substuff2 = 5 and a zero tag */
+        static const uint8_t submsg[] = {0xC2, 0x03, 0x06, 0x0A, 0x01, 0x78,
+                                         0x10, 0x05, 0x00};
+        size_t length = count + sizeof(submsg);
+
+        TEST(length <= sizeof(buffer));
+        memcpy(buffer + count, submsg, sizeof(submsg));
+        TEST(pull_decode(buffer, length));
+        TEST(g_pulled.has_opt_submsg && g_pulled.opt_submsg.substuff2 == 5);
+        TEST(push_decode(buffer, length, length));
+        TEST(memcmp(&g_pulled, &g_pushed, sizeof(AllTypes)) == 0);
+        TEST(push_decode(buffer, length, 1));
+        TEST(memcmp(&g_pulled, &g_pushed, sizeof(AllTypes)) == 0);
+    }
+
+    COMMENT("Errors")
+    {
+        pb_decoder_state_t state;
+        static const uint8_t overflow[] = {0x08, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                           0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+        static const uint8_t too_long[] = {0xB2, 0x09, 0x05, 0x08, 0x01};
+
+        pb_decoder_init(&state, AllTypes_fields, &g_pushed);
+        TEST(!pb_decode_feed(&state, overflow, sizeof(overflow)));
+        TEST(!pb_decode_finish(&state));
+
+        pb_decoder_init(&state, AllTypes_fields, &g_pushed);
+        TEST(pb_decode_feed(&state, too_long, sizeof(too_long)));
+        TEST(!pb_decode_finish(&state));
+        TEST(strcmp(PB_GET_ERROR(&state), "end-of-stream") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,202 @@
+/* Decodes repeated pointer fields one entry at a time and checks that the
+ * arrays are grown geometrically, that the expected_count option reserves
+ * the space at once, and that interleaved and merged fields still decode
+ * correctly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "repeated_growth.pb.h"
+#include "malloc_wrappers.h"
+#include "unittests.h"
+
+/* The counting_realloc() in the tests limits allocations to 1 MB */
+#define ITEM_COUNT 30000
+
+static bool write_item(pb_ostream_t *stream, uint32_t tag, int32_t id, char *name)
+{
+    Item item;
+    item.id = id;
+    item.name = name;
+    return pb_encode_tag(stream, PB_WT_STRING, tag) &&
+           pb_encode_submessage(stream, Item_fields, &item);
+}
+
+static bool write_string(pb_ostream_t *stream, uint32_t tag, const char *str)
+{
+    return pb_encode_tag(stream, PB_WT_STRING, tag) &&
+           pb_encode_string(stream, (const uint8_t*)str, strlen(str));
+}
+
+static bool write_number(pb_ostream_t *stream, int32_t value)
+{
+    return pb_encode_tag(stream, PB_WT_VARINT, Container_numbers_tag) &&
+           pb_encode_varint(stream, (uint64_t)(int64_t)value);
+}
+
+/* Packed array of the numbers start ... start + count - 1 */
+static bool write_packed_numbers(pb_ostream_t *stream, int32_t start, int32_t count)
+{
+    uint8_t buf[64];
+    pb_ostream_t sub = pb_ostream_from_buffer(buf, sizeof(buf));
+    int32_t i;
+    
+    for (i = 0; i < count; i++)
+    {
+        if (!pb_encode_varint(&sub, (uint64_t)(start + i)))
+            return false;
+    }
+    
+    return pb_encode_tag(stream, PB_WT_STRING, Container_numbers_tag) &&
+           pb_encode_string(stream, buf, sub.bytes_written);
+}
+
+int main()
+{
+    int status = 0;
+    size_t bufsize = ITEM_COUNT * 8 + 1024;
+    uint8_t *buffer = malloc(bufsize);
+    size_t msglen;
+    Container msg;
+    int i;
+    
+    COMMENT("Large repeated submessage field")
+    {
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, bufsize);
+        pb_istream_t istream;
+        size_t reallocs;
+        bool ok = true;
+        
+        for (i = 0; i < ITEM_COUNT && ok; i++)
+            ok = write_item(&ostream, Container_items_tag, i, NULL);
+        TEST(ok);
+        msglen = ostream.bytes_written;
+        
+        memset(&msg, 0, sizeof(msg));
+        istream = pb_istream_from_buffer(buffer, msglen);
+        reallocs = get_realloc_count();
+        TEST(pb_decode(&istream, Container_fields, &msg));
+        
+        /* Growth and the final shrink, instead of one per entry */
+        TEST(get_realloc_count() - reallocs < 40);
+        TEST(msg.items_count == ITEM_COUNT);
+        
+        ok = (msg.items_count == ITEM_COUNT);
+        for (i = 0; i < ITEM_COUNT && ok; i++)
+            ok = msg.items[i].id == i && msg.items[i].name == NULL;
+        TEST(ok);
+        
+        pb_release(Container_fields, &msg);
+        TEST(get_alloc_count() == 0);
+    }
+    
+    COMMENT("Arena gets the unused capacity back")
+    {
+        static uint8_t arena_buffer[2 * ITEM_COUNT * sizeof(Item)];
+        pb_arena_t arena;
+        pb_istream_t istream = pb_istream_from_buffer(buffer, msglen);
+        
+        pb_arena_init(&arena, arena_buffer, sizeof(arena_buffer), 0);
+        memset(&msg, 0, sizeof(msg));
+        TEST(pb_decode_arena(&istream, Container_fields, &msg, &arena));
+        TEST(msg.items_count == ITEM_COUNT && msg.items[ITEM_COUNT - 1].id == ITEM_COUNT - 1);
+        TEST(arena.used < ITEM_COUNT * sizeof(Item) + 64);
+        pb_arena_reset(&arena);
+    }
+    
+    COMMENT("Expected count reserves the array at once")
+    {
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, bufsize);
+        pb_istream_t istream;
+        size_t reallocs;
+        bool ok = true;
+        
+        for (i = 0; i < 100 && ok; i++)
+            ok = write_item(&ostream, Container_reserved_tag, i, NULL);
+        TEST(ok);
+        
+        memset(&msg, 0, sizeof(msg));
+        istream = pb_istream_from_buffer(buffer, ostream.bytes_written);
+        reallocs = get_realloc_count();
+        TEST(pb_decode(&istream, Container_fields, &msg));
+        TEST(get_realloc_count() - reallocs == 1);
+        TEST(msg.reserved_count == 100 && msg.reserved[99].id == 99);
+        pb_release(Container_fields, &msg);
+    }
+    
+    COMMENT("Interleaved fields and merging")
+    {
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, bufsize);
+        pb_istream_t istream;
+        char name[16];
+        bool ok = true;
+        
+        for (i = 0; i < 50 && ok; i++)
+        {
+            sprintf(name, "item%d", i);
+            ok = write_item(&ostream, Container_items_tag, i, name) &&
+                 write_string(&ostream, Container_names_tag, name) &&
+                 write_string(&ostream, Container_names_tag, "x") &&
+                 write_number(&ostream, 2 * i);
+            
+            /* Packed and unpacked entries of the same field */
+            if (i % 10 == 0)
+                ok = ok && write_packed_numbers(&ostream, 1000 + i, 5);
+        }
+        TEST(ok);
+        msglen = ostream.bytes_written;
+        
+        memset(&msg, 0, sizeof(msg));
+        istream = pb_istream_from_buffer(buffer, msglen);
+        TEST(pb_decode(&istream, Container_fields, &msg));
+        
+        /* Decode the same data again, appending to the arrays */
+        istream = pb_istream_from_buffer(buffer, msglen);
+        TEST(pb_decode_noinit(&istream, Container_fields, &msg));
+        
+        TEST(msg.items_count == 100);
+        TEST(msg.names_count == 200);
+        TEST(msg.numbers_count == 150);
+        
+        ok = (msg.items_count == 100 && msg.names_count == 200);
+        for (i = 0; i < 100 && ok; i++)
+        {
+            sprintf(name, "item%d", i % 50);
+            ok = msg.items[i].id == i % 50 &&
+                 strcmp(msg.items[i].name, name) == 0 &&
+                 strcmp(msg.names[2 * i], name) == 0 &&
+                 strcmp(msg.names[2 * i + 1], "x") == 0;
+        }
+        TEST(ok);
+        
+        /* Every 10th unpacked number is followed by 5 packed ones */
+        ok = (msg.numbers_count == 150);
+        {
+            pb_size_t pos = 0;
+            int j;
+            for (i = 0; i < 100 && ok; i++)
+            {
+                ok = msg.numbers[pos++] == 2 * (i % 50);
+                if (i % 10 == 0)
+                {
+                    for (j = 0; j < 5; j++)
+                        ok = ok && msg.numbers[pos++] == 1000 + (i % 50) + j;
+                }
+            }
+        }
+        TEST(ok);
+        
+        pb_release(Container_fields, &msg);
+        TEST(get_alloc_count() == 0);
+    }
+    
+    free(buffer);
+    
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+    
+    return status;
+}
@@ -0,0 +1,101 @@
+/* Decodes the message from stdin and encodes it again with the resumable
+ * encoder, writing it in chunks of all sizes. Checks that the output is the
+ * same as with pb_encode().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+static AllTypes g_msg;
+
+/* Encode in chunks of the given size. Returns the total size, or 0 if
+ * encoding fails or the chunks are not filled completely. */
+static size_t encode_chunks(uint8_t *buffer, size_t bufsize, size_t chunk)
+{
+    pb_encoder_state_t state;
+    size_t total = 0;
+
+    pb_encoder_init(&state, AllTypes_fields, &g_msg);
+    while (!state.done)
+    {
+        size_t count;
+        size_t size = bufsize - total;
+        if (size > chunk)
+            size = chunk;
+
+        if (!pb_encode_fill(&state, buffer + total, size, &count))
+            return 0;
+
+        total += count;
+        if (!state.done && count != size)
+            return 0;
+    }
+
+    return total;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t input[1024];
+    uint8_t expected[1024];
+    uint8_t buffer[1024];
+    size_t count, size;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(input, 1, sizeof(input), stdin);
+
+    {
+        pb_istream_t stream = pb_istream_from_buffer(input, count);
+        pb_ostream_t ostream = pb_ostream_from_buffer(expected, sizeof(expected));
+        TEST(pb_decode(&stream, AllTypes_fields, &g_msg));
+        TEST(pb_encode(&ostream, AllTypes_fields, &g_msg));
+        size = ostream.bytes_written;
+    }
+
+    COMMENT("Same output with all chunk sizes")
+    {
+        size_t chunk, errors = 0;
+
+        for (chunk = 1; chunk <= size + 1; chunk++)
+        {
+            memset(buffer, 0, sizeof(buffer));
+            if (encode_chunks(buffer, sizeof(buffer), chunk) != size ||
+                memcmp(buffer, expected, size) != 0)
+            {
+                errors++;
+            }
+        }
+        TEST(errors == 0);
+        printf("Encoded %u bytes in chunks of 1 to %u bytes\n",
+               (unsigned)size, (unsigned)size + 1);
+    }
+
+    COMMENT("Done when the last byte fits exactly")
+    {
+        pb_encoder_state_t state;
+        pb_encoder_init(&state, AllTypes_fields, &g_msg);
+        TEST(pb_encode_fill(&state, buffer, size, &count) && count == size);
+        TEST(state.done);
+    }
+
+    COMMENT("Errors")
+    {
+        pb_encoder_state_t state;
+        g_msg.rep_int32_count = 6;
+        pb_encoder_init(&state, AllTypes_fields, &g_msg);
+        TEST(!pb_encode_fill(&state, buffer, sizeof(buffer), &count));
+        TEST(strcmp(PB_GET_ERROR(&state), "array max size exceeded") == 0);
+        TEST(!pb_encode_fill(&state, buffer, sizeof(buffer), &count) && count == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,119 @@
+/* Encodes the message from stdin again with pb_encode() and with
+ * pb_encode_reverse(), and checks that the output is identical. The same
+ * is checked for messages nested to different depths.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "nested.pb.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+#define MAX_DEPTH 6
+
+static AllTypes g_alltypes;
+static Level1 g_level1;
+static Level2 g_level2;
+static Level3 g_level3;
+static Level4 g_level4;
+static Level5 g_level5;
+static Level6 g_level6;
+
+#define FILL_NODE(msg) \
+    (msg)->id = 1234; \
+    (msg)->has_name = true; \
+    strcpy((msg)->name, "node"); \
+    (msg)->values_count = 2; \
+    (msg)->values[0] = 5; \
+    (msg)->values[1] = 6;
+
+#define FILL_CHILDREN(msg, fill) \
+    (msg)->children_count = 1; \
+    fill(&(msg)->children[0]);
+
+static void fill6(Level6 *msg) { FILL_NODE(msg) }
+static void fill5(Level5 *msg) { FILL_NODE(msg) FILL_CHILDREN(msg, fill6) }
+static void fill4(Level4 *msg) { FILL_NODE(msg) FILL_CHILDREN(msg, fill5) }
+static void fill3(Level3 *msg) { FILL_NODE(msg) FILL_CHILDREN(msg, fill4) }
+static void fill2(Level2 *msg) { FILL_NODE(msg) FILL_CHILDREN(msg, fill3) }
+static void fill1(Level1 *msg) { FILL_NODE(msg) FILL_CHILDREN(msg, fill2) }
+
+/* Encode with both encoders, returns true if the outputs are identical.
+ * The size of the message is stored in *size. */
+static bool encode_both(const pb_field_t fields[], const void *msg, size_t *size)
+{
+    uint8_t buffer1[2048], buffer2[2048];
+    pb_ostream_t stream1 = pb_ostream_from_buffer(buffer1, sizeof(buffer1));
+    pb_ostream_t stream2 = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+
+    /* Something already in the stream before the message */
+    if (!pb_write(&stream1, (const uint8_t*)"ab", 2) ||
+        !pb_write(&stream2, (const uint8_t*)"ab", 2))
+        return false;
+
+    if (!pb_encode(&stream1, fields, msg) || !pb_encode_reverse(&stream2, fields, msg))
+        return false;
+
+    *size = stream1.bytes_written - 2;
+    return stream1.bytes_written == stream2.bytes_written &&
+           (uint8_t*)stream2.state == buffer2 + stream2.bytes_written &&
+           memcmp(buffer1, buffer2, stream1.bytes_written) == 0;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[2048];
+    size_t count, size;
+    const pb_field_t *fields[MAX_DEPTH] = {
+        Level6_fields, Level5_fields, Level4_fields,
+        Level3_fields, Level2_fields, Level1_fields
+    };
+    const void *msgs[MAX_DEPTH] = {
+        &g_level6, &g_level5, &g_level4, &g_level3, &g_level2, &g_level1
+    };
+
+    SET_BINARY_MODE(stdin);
+    count = fread(buffer, 1, sizeof(buffer), stdin);
+
+    fill1(&g_level1);
+    fill2(&g_level2);
+    fill3(&g_level3);
+    fill4(&g_level4);
+    fill5(&g_level5);
+    fill6(&g_level6);
+
+    COMMENT("Same output as pb_encode()")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+        int depth;
+
+        TEST(pb_decode(&stream, AllTypes_fields, &g_alltypes));
+        TEST(encode_both(AllTypes_fields, &g_alltypes, &size));
+
+        for (depth = 0; depth < MAX_DEPTH; depth++)
+        {
+            TEST(encode_both(fields[depth], msgs[depth], &size));
+        }
+    }
+
+    COMMENT("Errors")
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer, size - 1);
+        TEST(!pb_encode_reverse(&stream, Level1_fields, &g_level1));
+        TEST(strcmp(PB_GET_ERROR(&stream), "stream full") == 0);
+
+        g_alltypes.rep_int32_count = 6;
+        stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        TEST(!pb_encode_reverse(&stream, AllTypes_fields, &g_alltypes));
+        TEST(strcmp(PB_GET_ERROR(&stream), "array max size exceeded") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,176 @@
+/* Decodes a message with a large unknown field from a file, using a plain
+ * callback stream and a buffered stream, both with and without seeking.
+ * Checks that the results are the same and compares the number of reads.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "pb_io.h"
+#include "stream_skip.pb.h"
+#include "unittests.h"
+
+#define BLOB_SIZE 200000
+
+static unsigned long g_reads;
+static unsigned long g_skips;
+
+static bool write_blob(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+    uint8_t block[1000];
+    size_t i;
+    PB_UNUSED(arg);
+
+    memset(block, 0x55, sizeof(block));
+    if (!pb_encode_tag_for_field(stream, field) ||
+        !pb_encode_varint(stream, BLOB_SIZE))
+        return false;
+
+    for (i = 0; i < BLOB_SIZE; i += sizeof(block))
+    {
+        if (!pb_write(stream, block, sizeof(block)))
+            return false;
+    }
+    return true;
+}
+
+static bool write_file(pb_ostream_t *stream, const uint8_t *buf, size_t count)
+{
+    return fwrite(buf, 1, count, (FILE*)stream->state) == count;
+}
+
+static bool read_file(pb_istream_t *stream, uint8_t *buf, size_t count)
+{
+    FILE *file = (FILE*)stream->state;
+    size_t result = fread(buf, 1, count, file);
+    g_reads++;
+
+    if (result == 0 && feof(file))
+        stream->bytes_left = 0; /* EOF */
+
+    return result == count;
+}
+
+static bool skip_file(pb_istream_t *stream, size_t count)
+{
+    g_skips++;
+    return pb_seek_file(stream->state, count);
+}
+
+static size_t counting_fill(void *source, uint8_t *buf, size_t count)
+{
+    g_reads++;
+    return pb_fill_from_file(source, buf, count);
+}
+
+static bool counting_seek(void *source, size_t count)
+{
+    g_skips++;
+    return pb_seek_file(source, count);
+}
+
+/* Decode Partial from the start of the file. Returns the number of
+ * reads, or 0 if decoding fails or gives wrong values. */
+static unsigned long decode_file(FILE *file, bool buffered, bool seek)
+{
+    Partial msg;
+    bool status;
+
+    rewind(file);
+    g_reads = 0;
+    g_skips = 0;
+
+    if (buffered)
+    {
+        uint8_t buffer[256];
+        pb_readahead_t readahead;
+        pb_istream_t stream;
+
+        pb_readahead_init(&readahead, buffer, sizeof(buffer), &counting_fill, file);
+        if (seek)
+            readahead.seek = &counting_seek;
+        stream = pb_istream_from_readahead(&readahead, SIZE_MAX);
+        status = pb_decode(&stream, Partial_fields, &msg);
+    }
+    else
+    {
+        pb_istream_t stream = {&read_file, NULL, SIZE_MAX};
+        stream.state = file;
+        if (seek)
+            stream.skip = &skip_file;
+        status = pb_decode(&stream, Partial_fields, &msg);
+    }
+
+    if (!status || msg.id != 1234 || msg.tail != 5678)
+        return 0;
+
+    return g_reads;
+}
+
+int main()
+{
+    int status = 0;
+    FILE *file = tmpfile();
+    FILE *truncated = tmpfile();
+
+    if (!file || !truncated)
+    {
+        perror("tmpfile");
+        return 1;
+    }
+
+    {
+        Full msg = Full_init_zero;
+        pb_ostream_t stream = {&write_file, NULL, SIZE_MAX, 0};
+        stream.state = file;
+        msg.id = 1234;
+        msg.blob.funcs.encode = &write_blob;
+        msg.tail = 5678;
+        TEST(pb_encode(&stream, Full_fields, &msg));
+
+        /* The same message without the last 1000 bytes */
+        stream.state = truncated;
+        stream.max_size = stream.bytes_written - 1000;
+        stream.bytes_written = 0;
+        TEST(!pb_encode(&stream, Full_fields, &msg));
+        fflush(file);
+        fflush(truncated);
+    }
+
+    COMMENT("Callback stream")
+    {
+        unsigned long reads_plain, reads_skip;
+        reads_plain = decode_file(file, false, false);
+        TEST(reads_plain > BLOB_SIZE / 16);
+        reads_skip = decode_file(file, false, true);
+        TEST(reads_skip > 0 && reads_skip < 20 && g_skips == 1);
+        printf("Reads without skip: %lu, with skip: %lu\n", reads_plain, reads_skip);
+    }
+
+    COMMENT("Buffered stream")
+    {
+        unsigned long reads_plain, reads_seek;
+        reads_plain = decode_file(file, true, false);
+        TEST(reads_plain > BLOB_SIZE / 256);
+        reads_seek = decode_file(file, true, true);
+        TEST(reads_seek > 0 && reads_seek < 5 && g_skips == 1);
+        printf("Reads without seek: %lu, with seek: %lu\n", reads_plain, reads_seek);
+    }
+
+    COMMENT("Truncated file")
+    {
+        TEST(decode_file(truncated, false, false) == 0);
+        TEST(decode_file(truncated, false, true) == 0);
+        TEST(decode_file(truncated, true, false) == 0);
+        TEST(decode_file(truncated, true, true) == 0);
+    }
+
+    fclose(file);
+    fclose(truncated);
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,164 @@
+/* Decodes buffers full of varints with pb_decode_varint() and checks the
+ * values, for each varint length and for a mix of lengths. Then checks that
+ * pb_encode_varint() gives the same bytes as a simple reference encoder.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "unittests.h"
+
+#define VALUE_COUNT 1000
+
+static uint8_t g_buffer[VALUE_COUNT * 10 + 10];
+static uint8_t g_output[VALUE_COUNT * 10 + 10];
+static uint64_t g_values[VALUE_COUNT];
+
+/* Simple pseudo-random number generator, so that results are repeatable */
+static uint32_t g_seed = 1;
+static uint32_t random32(void)
+{
+    g_seed = g_seed * 1103515245U + 12345U;
+    return g_seed;
+}
+
+static uint64_t random64(void)
+{
+    uint64_t result = random32();
+    return (result << 32) | random32();
+}
+
+/* Generate a value that takes the given number of bytes as a varint,
+ * or random number of bytes between 1 and 10 if length is 0. */
+static uint64_t random_value(int length)
+{
+    uint64_t value;
+    int bits;
+
+    if (length == 0)
+        length = (int)(random32() % 10) + 1;
+
+    bits = length * 7;
+    if (bits >= 64)
+        return random64() | ((uint64_t)1 << 63);
+
+    value = random64() & (((uint64_t)1 << bits) - 1);
+    value |= (uint64_t)1 << (bits - 7);
+    return value;
+}
+
+/* Reference encoder, writes the varint one byte at a time */
+static size_t encode_varint(uint8_t *buf, uint64_t value)
+{
+    size_t i = 0;
+    while (value > 0x7F)
+    {
+        buf[i++] = (uint8_t)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    buf[i++] = (uint8_t)value;
+    return i;
+}
+
+static size_t fill_buffer(int length)
+{
+    size_t pos = 0;
+    int i;
+
+    for (i = 0; i < VALUE_COUNT; i++)
+    {
+        g_values[i] = random_value(length);
+        pos += encode_varint(g_buffer + pos, g_values[i]);
+    }
+
+    return pos;
+}
+
+/* Returns number of errors */
+static int check_decode(int length)
+{
+    size_t size = fill_buffer(length);
+    pb_istream_t stream = pb_istream_from_buffer(g_buffer, size);
+    uint64_t value;
+    int i;
+
+    for (i = 0; i < VALUE_COUNT; i++)
+    {
+        if (!pb_decode_varint(&stream, &value) || value != g_values[i])
+        {
+            printf("Value %d mismatch with length %d\n", i, length);
+            return 1;
+        }
+    }
+
+    return stream.bytes_left != 0;
+}
+
+/* Returns number of errors */
+static int check_encode(int length)
+{
+    size_t size = fill_buffer(length);
+    pb_ostream_t stream = pb_ostream_from_buffer(g_output, sizeof(g_output));
+    int i;
+
+    for (i = 0; i < VALUE_COUNT; i++)
+    {
+        if (!pb_encode_varint(&stream, g_values[i]))
+            return 1;
+    }
+
+    if (stream.bytes_written != size || memcmp(g_output, g_buffer, size) != 0)
+    {
+        printf("Output mismatch with length %d\n", length);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main()
+{
+    int status = 0;
+    int length;
+
+    COMMENT("Decode varints of each length, and of mixed lengths");
+    for (length = 0; length <= 10; length++)
+    {
+        TEST(check_decode(length) == 0);
+    }
+
+    COMMENT("Encode varints of each length, and of mixed lengths");
+    for (length = 0; length <= 10; length++)
+    {
+        TEST(check_encode(length) == 0);
+    }
+
+    COMMENT("Check all lengths at end of buffer");
+    for (length = 1; length <= 10; length++)
+    {
+        uint64_t value = random_value(length);
+        uint64_t result;
+        size_t size = encode_varint(g_buffer, value);
+        pb_istream_t stream = pb_istream_from_buffer(g_buffer, size);
+        TEST(pb_decode_varint(&stream, &result) && result == value && stream.bytes_left == 0);
+    }
+
+    COMMENT("Encode all lengths at end of buffer");
+    for (length = 1; length <= 10; length++)
+    {
+        uint64_t value = random_value(length);
+        size_t size = encode_varint(g_buffer, value);
+        pb_ostream_t stream = pb_ostream_from_buffer(g_output, size);
+        TEST(pb_encode_varint(&stream, value) && stream.bytes_written == size &&
+             memcmp(g_output, g_buffer, size) == 0);
+
+        stream = pb_ostream_from_buffer(g_output, size - 1);
+        TEST(!pb_encode_varint(&stream, value) && stream.bytes_written == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,142 @@
+/* Decodes a message with FT_VIEW fields from a memory buffer, checks that
+ * the views point into the buffer, encodes the message back and compares
+ * the result. Also checks that decoding from a callback stream fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "view_fields.pb.h"
+#include "unittests.h"
+
+static const char g_blob[] = "\x00\x01\x02\xFF binary data";
+static const char *g_tags[] = {"first", "second", "third"};
+
+static pb_view_t make_view(const void *ptr, size_t size)
+{
+    pb_view_t view;
+    view.ptr = (const uint8_t*)ptr;
+    view.size = (pb_size_t)size;
+    return view;
+}
+
+static bool view_equals(pb_view_t view, const void *ptr, size_t size)
+{
+    return view.size == size && memcmp(view.ptr, ptr, size) == 0;
+}
+
+static bool view_inside(pb_view_t view, const uint8_t *buffer, size_t size)
+{
+    return view.ptr >= buffer && view.ptr + view.size <= buffer + size;
+}
+
+static bool callback_read(pb_istream_t *stream, uint8_t *buf, size_t count)
+{
+    const uint8_t **pos = (const uint8_t**)stream->state;
+    memcpy(buf, *pos, count);
+    *pos += count;
+    return true;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[256];
+    uint8_t buffer2[256];
+    size_t msglen;
+    ViewMessage msg = ViewMessage_init_zero;
+    ViewMessage decoded;
+    size_t i;
+    
+    msg.name = make_view("view test", 9);
+    msg.has_data = true;
+    msg.data = make_view(g_blob, sizeof(g_blob) - 1);
+    msg.tags_count = 3;
+    for (i = 0; i < 3; i++)
+        msg.tags[i] = make_view(g_tags[i], strlen(g_tags[i]));
+    msg.has_sub = true;
+    msg.sub.blob = make_view(NULL, 0);
+    msg.sub.has_number = true;
+    msg.sub.number = 42;
+    msg.has_end = true;
+    msg.end = 1234;
+    
+    COMMENT("Encode from views")
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        TEST(pb_encode(&stream, ViewMessage_fields, &msg));
+        msglen = stream.bytes_written;
+        
+        /* Same bytes as a plain string field on the wire */
+        TEST(buffer[0] == 0x0A && buffer[1] == 9);
+        TEST(memcmp(buffer + 2, "view test", 9) == 0);
+    }
+    
+    COMMENT("Decode to views")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, msglen);
+        memset(&decoded, 0xAA, sizeof(decoded));
+        TEST(pb_decode(&stream, ViewMessage_fields, &decoded));
+        
+        TEST(view_equals(decoded.name, "view test", 9));
+        TEST(view_inside(decoded.name, buffer, msglen));
+        TEST(decoded.has_data);
+        TEST(view_equals(decoded.data, g_blob, sizeof(g_blob) - 1));
+        TEST(view_inside(decoded.data, buffer, msglen));
+        TEST(decoded.tags_count == 3);
+        for (i = 0; i < 3; i++)
+        {
+            TEST(view_equals(decoded.tags[i], g_tags[i], strlen(g_tags[i])));
+            TEST(view_inside(decoded.tags[i], buffer, msglen));
+        }
+        TEST(decoded.has_sub && decoded.sub.blob.size == 0);
+        TEST(decoded.sub.has_number && decoded.sub.number == 42);
+        TEST(decoded.has_end && decoded.end == 1234);
+    }
+    
+    COMMENT("Encode back from decoded views")
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+        TEST(pb_encode(&stream, ViewMessage_fields, &decoded));
+        TEST(stream.bytes_written == msglen);
+        TEST(memcmp(buffer, buffer2, msglen) == 0);
+    }
+    
+    COMMENT("Missing optional view is left empty")
+    {
+        ViewMessage empty = ViewMessage_init_zero;
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+        pb_istream_t istream;
+        empty.name = make_view("x", 1);
+        TEST(pb_encode(&ostream, ViewMessage_fields, &empty));
+        
+        istream = pb_istream_from_buffer(buffer2, ostream.bytes_written);
+        memset(&decoded, 0xAA, sizeof(decoded));
+        TEST(pb_decode(&istream, ViewMessage_fields, &decoded));
+        TEST(view_equals(decoded.name, "x", 1));
+        TEST(!decoded.has_data && decoded.data.ptr == NULL && decoded.data.size == 0);
+        TEST(decoded.tags_count == 0);
+    }
+    
+    COMMENT("Truncated view fails to decode")
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, 5);
+        TEST(!pb_decode(&stream, ViewMessage_fields, &decoded));
+    }
+    
+    COMMENT("Views require a buffer stream")
+    {
+        const uint8_t *pos = buffer;
+        pb_istream_t stream = {&callback_read, NULL, 0};
+        stream.state = &pos;
+        stream.bytes_left = msglen;
+        TEST(!pb_decode(&stream, ViewMessage_fields, &decoded));
+        TEST(strcmp(PB_GET_ERROR(&stream), "view requires buffer stream") == 0);
+    }
+    
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+    
+    return status;
+}